@@ -24,13 +24,35 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <time.h>
+#include <poll.h>
 
 /* buffer size for a name tag */
 #define NAME_BUF_LEN (UCHAR_MAX + 1)
+/* initial size of the connection receive buffer */
+#define RECV_BUF_LEN 4096
+/* maximum size a grown receive buffer is kept at between large messages */
+#define RECV_BUF_KEEP 65536
+/* number of small messages after which a grown receive buffer is shrunk */
+#define RECV_SHRINK_COUNT 32
+/* maximum number of iovecs passed to a single sendmsg() */
+#define SEND_IOV_MAX 64
+/* size of the request buffer stored inline with the request */
+#define REQ_INLINE_LEN 64
+/* maximum number of requests kept for recycling per connection */
+#define REQ_POOL_MAX 16
+/* maximum buffer size of a request kept for recycling */
+#define REQ_POOL_BUF_MAX 4096
+/* size of the window generated requests get filled up to */
+#define GEN_WINDOW_LEN 8192
 
 enum davici_packet_type {
 	DAVICI_CMD_REQUEST = 0,
@@ -43,26 +65,97 @@ enum davici_packet_type {
 	DAVICI_EVENT = 7,
 };
 
+struct davici_ref {
+	unsigned int offset;
+	const void *buf;
+	unsigned int len;
+	davici_releasecb release;
+	void *user;
+};
+
+/* FNV-1a offset basis for message hashes and checksums */
+#define FNV_BASIS 0xcbf29ce484222325ULL
+/* magic and version of request cache files */
+#define CACHE_MAGIC 0x44564343
+#define CACHE_VERSION 1
+
+struct davici_message {
+	unsigned int refs;
+	unsigned int len;
+	unsigned char *buf;
+	struct davici_cache *cache;
+	unsigned char data[0];
+};
+
+struct davici_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t tag;
+	uint32_t count;
+	uint32_t checksum[2];
+};
+
+struct davici_cache {
+	unsigned int refs;
+	unsigned int count;
+	size_t size;
+	unsigned char *map;
+	unsigned int offsets[0];
+};
+
 struct davici_request {
 	struct davici_request *next;
+	struct davici_conn *pool;
+	struct davici_message *msg;
 	unsigned int allocated;
 	unsigned int used;
 	unsigned int sent;
+	uint32_t hdr;
 	unsigned char *buf;
 	int err;
 	davici_cb cb;
+	davici_elementcb elementcb;
 	void *user;
+	unsigned int *slots;
+	unsigned int slot_count;
+	unsigned int slot_allocated;
+	struct davici_ref *refs;
+	unsigned int ref_count;
+	unsigned int ref_allocated;
+	unsigned int ref_len;
+	davici_generatecb gen;
+	unsigned int gen_index;
+	unsigned int gen_hlen;
+	unsigned int gen_base;
+	unsigned int gen_total;
+	int gen_more;
+	int measure;
+	int fragment;
+	unsigned int checked;
+	unsigned char space[REQ_INLINE_LEN];
 };
 
 struct davici_packet {
 	unsigned int received;
-	char len[sizeof(uint32_t)];
 	unsigned char *buf;
 };
 
+struct davici_recvbuf {
+	unsigned int allocated;
+	unsigned int used;
+	unsigned int small;
+	unsigned char *buf;
+};
+
+struct read_budget {
+	unsigned int messages;
+	uint64_t deadline;
+};
+
 struct davici_response {
 	struct davici_packet *pkt;
 	unsigned int pos;
+	unsigned int elem;
 	unsigned int buflen;
 	void *buf;
 	char name[NAME_BUF_LEN];
@@ -70,6 +163,21 @@ struct davici_response {
 	unsigned int list;
 };
 
+struct davici_stream {
+	struct davici_request *req;
+	struct davici_response res;
+	unsigned int remaining;
+	unsigned int need;
+	int err;
+	char name[NAME_BUF_LEN];
+};
+
+struct sync_wait {
+	int done;
+	int err;
+	struct davici_response *res;
+};
+
 struct davici_event {
 	struct davici_event *next;
 	davici_cb cb;
@@ -80,14 +188,110 @@ struct davici_event {
 struct davici_conn {
 	int s;
 	struct davici_request *reqs;
+	struct davici_request *tail;
+	struct davici_request *unsent;
+	unsigned int unsent_count;
+	unsigned int unsent_bytes;
+	unsigned int inflight_count;
+	unsigned int window;
+	unsigned int max_msg;
+	unsigned int max_unsent;
 	struct davici_event *events;
-	struct davici_packet pkt;
+	struct davici_recvbuf rbuf;
+	struct davici_stream stream;
+	struct davici_request *pool;
+	unsigned int pooled;
 	davici_fdcb fdcb;
 	void *user;
 	enum davici_fdops ops;
+	enum davici_fdops wanted;
+	unsigned int batch;
+	unsigned int dispatching;
+	int deferred;
 	int connecting;
+	int tcp;
+};
+
+static void* default_alloc(size_t size, void *user)
+{
+	return malloc(size);
+}
+
+static void* default_resize(void *ptr, size_t size, void *user)
+{
+	return realloc(ptr, size);
+}
+
+static void default_release(void *ptr, void *user)
+{
+	free(ptr);
+}
+
+static struct davici_allocator allocator = {
+	.alloc = default_alloc,
+	.resize = default_resize,
+	.release = default_release,
 };
 
+void davici_set_allocator(const struct davici_allocator *alloc)
+{
+	if (alloc)
+	{
+		allocator = *alloc;
+	}
+	else
+	{
+		allocator.alloc = default_alloc;
+		allocator.resize = default_resize;
+		allocator.release = default_release;
+		allocator.user = NULL;
+	}
+}
+
+static void* mem_alloc(size_t size)
+{
+	void *ptr;
+
+	ptr = allocator.alloc(size, allocator.user);
+	if (!ptr)
+	{
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+static void* mem_calloc(size_t size)
+{
+	void *ptr;
+
+	ptr = mem_alloc(size);
+	if (ptr)
+	{
+		memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+static void* mem_realloc(void *ptr, size_t size)
+{
+	void *new;
+
+	new = allocator.resize(ptr, size, allocator.user);
+	if (!new)
+	{
+		errno = ENOMEM;
+	}
+	return new;
+}
+
+static void mem_free(void *ptr)
+{
+	if (ptr)
+	{
+		allocator.release(ptr, allocator.user);
+	}
+}
+
 static int set_fdflags(int fd)
 {
 	int flags;
@@ -110,21 +314,27 @@ static int set_fdflags(int fd)
 int davici_connect_socket(int s, davici_fdcb fdcb, void *user,
 						  struct davici_conn **cp)
 {
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
 	struct davici_conn *c;
 	int err;
 
-	c = calloc(1, sizeof(*c));
+	c = mem_calloc(sizeof(*c));
 	if (!c)
 	{
 		return -errno;
 	}
 	c->fdcb = fdcb;
 	c->user = user;
+	if (getsockname(s, (struct sockaddr*)&addr, &len) == 0)
+	{
+		c->tcp = addr.ss_family == AF_INET || addr.ss_family == AF_INET6;
+	}
 
 	err = set_fdflags(s);
 	if (err < 0)
 	{
-		free(c);
+		mem_free(c);
 		return err;
 	}
 
@@ -176,22 +386,80 @@ static unsigned int max_integer(unsigned int a, unsigned int b)
 	return a > b ? a : b;
 }
 
-static int update_ops(struct davici_conn *c, enum davici_fdops ops)
+static unsigned int min_integer(unsigned int a, unsigned int b)
+{
+	return a < b ? a : b;
+}
+
+static int commit_ops(struct davici_conn *c)
 {
 	int ret;
 
-	if (ops == c->ops)
+	if (c->wanted == c->ops)
 	{
 		return 0;
 	}
-	ret = c->fdcb(c, c->s, ops, c->user);
+	ret = c->fdcb(c, c->s, c->wanted, c->user);
 	if (ret == 0)
 	{
-		c->ops = ops;
+		c->ops = c->wanted;
 	}
 	return -abs(ret);
 }
 
+static int update_ops(struct davici_conn *c, enum davici_fdops ops)
+{
+	c->wanted = ops;
+	if (c->batch || c->deferred)
+	{
+		return 0;
+	}
+	return commit_ops(c);
+}
+
+static int flush_deferred(struct davici_conn *c, int ret)
+{
+	int err;
+
+	if (!c->deferred || c->batch)
+	{
+		return ret;
+	}
+	err = commit_ops(c);
+	if (ret < 0)
+	{
+		return ret;
+	}
+	if (err < 0)
+	{
+		return err;
+	}
+	return ret;
+}
+
+static int can_send(struct davici_conn *c)
+{
+	if (!c->unsent)
+	{
+		return 0;
+	}
+	if (c->window && c->inflight_count >= c->window)
+	{
+		/* allow to complete a partially sent request */
+		return c->unsent->sent != 0;
+	}
+	return 1;
+}
+
+static int update_write(struct davici_conn *c)
+{
+	if (c->connecting || can_send(c))
+	{
+		return update_ops(c, c->wanted | DAVICI_WRITE);
+	}
+	return update_ops(c, c->wanted & ~DAVICI_WRITE);
+}
+
 int davici_connect_tcp(struct sockaddr *addr, davici_fdcb fdcb, void *user,
 					   struct davici_conn **cp)
 {
@@ -266,7 +534,7 @@ static struct davici_request* pop_request(struct davici_conn *c,
 	struct davici_request *req;
 
 	req = c->reqs;
-	if (!req || !req->cb || req->used < 2 ||
+	if (!req || req == c->unsent || !req->cb || req->used < 2 ||
 		req->buf[0] != type || req->used - 2 < req->buf[1])
 	{
 		return NULL;
@@ -276,13 +544,69 @@ static struct davici_request* pop_request(struct davici_conn *c,
 		return NULL;
 	}
 	c->reqs = req->next;
+	if (!c->reqs)
+	{
+		c->tail = NULL;
+	}
+	c->inflight_count--;
 	return req;
 }
 
+static unsigned int request_len(struct davici_request *req)
+{
+	if (req->gen)
+	{
+		return req->gen_total;
+	}
+	return req->used + req->ref_len;
+}
+
+static void release_refs(struct davici_request *req)
+{
+	struct davici_ref *ref;
+	unsigned int i;
+
+	for (i = 0; i < req->ref_count; i++)
+	{
+		ref = &req->refs[i];
+		if (ref->release)
+		{
+			ref->release(ref->buf, ref->len, ref->user);
+		}
+	}
+	req->ref_count = 0;
+	req->ref_len = 0;
+}
+
+static void free_request(struct davici_request *req)
+{
+	release_refs(req);
+	mem_free(req->refs);
+	if (req->msg)
+	{
+		davici_message_unref(req->msg);
+	}
+	else if (req->buf != req->space)
+	{
+		mem_free(req->buf);
+	}
+	mem_free(req->slots);
+	mem_free(req);
+}
+
 static void destroy_request(struct davici_request *req)
 {
-	free(req->buf);
-	free(req);
+	struct davici_conn *c = req->pool;
+
+	if (c && c->pooled < REQ_POOL_MAX && req->allocated <= REQ_POOL_BUF_MAX)
+	{
+		release_refs(req);
+		req->next = c->pool;
+		c->pool = req;
+		c->pooled++;
+		return;
+	}
+	free_request(req);
 }
 
 static int handle_cmd_response(struct davici_conn *c, struct davici_packet *pkt)
@@ -301,7 +625,7 @@ static int handle_cmd_response(struct davici_conn *c, struct davici_packet *pkt)
 
 	req->cb(c, 0, name, &res, req->user);
 	destroy_request(req);
-	return 0;
+	return update_write(c);
 }
 
 static int handle_cmd_unknown(struct davici_conn *c)
@@ -317,7 +641,7 @@ static int handle_cmd_unknown(struct davici_conn *c)
 
 	req->cb(c, -ENOSYS, name, NULL, req->user);
 	destroy_request(req);
-	return 0;
+	return update_write(c);
 }
 
 static int handle_event_unknown(struct davici_conn *c)
@@ -337,7 +661,7 @@ static int handle_event_unknown(struct davici_conn *c)
 
 	req->cb(c, -ENOENT, name, NULL, req->user);
 	destroy_request(req);
-	return 0;
+	return update_write(c);
 }
 
 static int remove_event(struct davici_conn *c, const char *name, davici_cb cb)
@@ -357,7 +681,7 @@ static int remove_event(struct davici_conn *c, const char *name, davici_cb cb)
 			{
 				c->events = ev->next;
 			}
-			free(ev);
+			mem_free(ev);
 			return 0;
 		}
 		prev = ev;
@@ -373,7 +697,7 @@ static int add_event(struct davici_conn *c, const char *name,
 	int len;
 
 	len = strlen(name);
-	ev = calloc(sizeof(*ev) + len + 1, 1);
+	ev = mem_calloc(sizeof(*ev) + len + 1);
 	if (!ev)
 	{
 		return -errno;
@@ -411,15 +735,12 @@ static int handle_event_confirm(struct davici_conn *c)
 	}
 	req->cb(c, err, name, NULL, req->user);
 	destroy_request(req);
-	return 0;
+	return update_write(c);
 }
 
 static int handle_event(struct davici_conn *c, struct davici_packet *pkt)
 {
-	struct davici_packet inner = {
-		.buf = pkt->buf + 1 + pkt->buf[0],
-		.received = pkt->received - 1 - pkt->buf[0],
-	};
+	struct davici_packet inner;
 	struct davici_response res = {
 		.pkt = &inner,
 	};
@@ -427,10 +748,12 @@ static int handle_event(struct davici_conn *c, struct davici_packet *pkt)
 	char name[NAME_BUF_LEN];
 	int err;
 
-	if (!pkt->received || pkt->buf[0] >= c->pkt.received - 1)
+	if (!pkt->received || pkt->buf[0] > pkt->received - 1)
 	{
 		return -EBADMSG;
 	}
+	inner.buf = pkt->buf + 1 + pkt->buf[0];
+	inner.received = pkt->received - 1 - pkt->buf[0];
 	err = copy_name(name, sizeof(name), pkt->buf + 1, pkt->buf[0]);
 	if (err < 0)
 	{
@@ -448,14 +771,15 @@ static int handle_event(struct davici_conn *c, struct davici_packet *pkt)
 	return 0;
 }
 
-static int handle_message(struct davici_conn *c)
+static int handle_message(struct davici_conn *c, unsigned char *buf,
+						  unsigned int size)
 {
 	struct davici_packet pkt = {
-		.buf = c->pkt.buf + 1,
-		.received = c->pkt.received - sizeof(c->pkt.len) - 1,
+		.buf = buf + 1,
+		.received = size - 1,
 	};
 
-	switch (c->pkt.buf[0])
+	switch (buf[0])
 	{
 		case DAVICI_CMD_RESPONSE:
 			return handle_cmd_response(c, &pkt);
@@ -472,470 +796,2375 @@ static int handle_message(struct davici_conn *c)
 	}
 }
 
-int davici_read(struct davici_conn *c)
+static int reserve_recvbuf(struct davici_conn *c)
 {
+	unsigned int needed = RECV_BUF_LEN;
 	uint32_t size;
-	int len, err = 0;
+	void *new;
 
-	while (!err)
+	if (c->stream.req)
 	{
-		while (c->pkt.received < sizeof(c->pkt.len))
-		{
-			len = recv(c->s, c->pkt.len + c->pkt.received,
-					   sizeof(c->pkt.len) - c->pkt.received, 0);
-			if (len == -1)
-			{
-				if (errno == EWOULDBLOCK || errno == EINTR)
-				{
-					return 0;
-				}
-				return -errno;
-			}
-			if (len == 0)
-			{
-				return -ECONNRESET;
-			}
-			c->pkt.received += len;
-		}
-		memcpy(&size, c->pkt.len, sizeof(size));
+		needed = max_integer(needed, c->stream.need);
+	}
+	else if (c->rbuf.used > sizeof(size))
+	{
+		memcpy(&size, c->rbuf.buf, sizeof(size));
 		size = ntohl(size);
-		if (!c->pkt.buf)
-		{
-			c->pkt.buf = malloc(size);
-			if (!c->pkt.buf)
-			{
-				return -errno;
-			}
-		}
-		while (c->pkt.received < size + sizeof(c->pkt.len))
+		if (size > UINT_MAX - sizeof(size))
 		{
-			len = recv(c->s, c->pkt.buf + c->pkt.received - sizeof(c->pkt.len),
-					   size - (c->pkt.received - sizeof(c->pkt.len)), 0);
-			if (len == -1)
-			{
-				if (errno == EWOULDBLOCK || errno == EINTR)
-				{
-					return 0;
-				}
-				return -errno;
-			}
-			if (len == 0)
-			{
-				return -ECONNRESET;
-			}
-			c->pkt.received += len;
+			return -EBADMSG;
 		}
-		if (size)
+		if (c->max_msg && size > c->max_msg)
 		{
-			err = handle_message(c);
+			return -EMSGSIZE;
 		}
-		else
+		needed = max_integer(needed, size + sizeof(size));
+	}
+	if (needed > c->rbuf.allocated)
+	{
+		new = mem_realloc(c->rbuf.buf, needed);
+		if (!new)
 		{
-			err = 0;
+			return -errno;
 		}
-		free(c->pkt.buf);
-		c->pkt.buf = NULL;
-		c->pkt.received = 0;
+		c->rbuf.buf = new;
+		c->rbuf.allocated = needed;
 	}
-	return err;
+	return 0;
 }
 
-int davici_write(struct davici_conn *c)
+static void shrink_recvbuf(struct davici_conn *c)
 {
-	struct davici_request *req;
-	uint32_t size;
-	int len, err;
-	socklen_t slen = sizeof(err);
+	void *new;
 
-	if (c->connecting)
+	new = mem_realloc(c->rbuf.buf, RECV_BUF_LEN);
+	if (new)
 	{
-		if (getsockopt(c->s, SOL_SOCKET, SO_ERROR, &err, &slen) != 0)
+		c->rbuf.buf = new;
+		c->rbuf.allocated = RECV_BUF_LEN;
+		c->rbuf.small = 0;
+	}
+}
+
+static void count_recvbuf(struct davici_conn *c, uint32_t size)
+{
+	if (c->rbuf.allocated > RECV_BUF_LEN)
+	{
+		if (size + sizeof(size) > RECV_BUF_LEN)
 		{
-			return -errno;
+			c->rbuf.small = 0;
 		}
-		if (err != 0)
+		else if (c->rbuf.small < RECV_SHRINK_COUNT)
 		{
-			return -err;
+			c->rbuf.small++;
 		}
-		c->connecting = 0;
 	}
-	req = c->reqs;
-	while (req)
+}
+
+static int want_shrink(struct davici_conn *c)
+{
+	if (c->rbuf.allocated <= RECV_BUF_LEN || c->rbuf.used > RECV_BUF_LEN)
 	{
-		while (req->sent < sizeof(req->used))
-		{
-			size = htonl(req->used);
-			len = send(c->s, (char*)&size + req->sent,
-					   sizeof(size) - req->sent, 0);
-			if (len == -1)
+		return 0;
+	}
+	/* keep a moderately grown buffer while large messages keep arriving,
+	 * but don't let a single huge message pin its memory */
+	return c->rbuf.allocated > RECV_BUF_KEEP ||
+		   c->rbuf.small >= RECV_SHRINK_COUNT;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int element_len(const unsigned char *buf, unsigned int len)
+{
+	unsigned int need;
+
+	if (len < 1)
+	{
+		return 1;
+	}
+	switch (buf[0])
+	{
+		case DAVICI_SECTION_START:
+		case DAVICI_LIST_START:
+			if (len < 2)
 			{
-				if (errno == EWOULDBLOCK || errno == EINTR)
-				{
-					return 0;
-				}
-				return -errno;
+				return 2;
 			}
-			req->sent += len;
-		}
-		while (req->sent < req->used + sizeof(size))
-		{
-			len = send(c->s, req->buf + req->sent - sizeof(size),
-					   req->used - (req->sent - sizeof(size)), 0);
-			if (len == -1)
+			return 2 + buf[1];
+		case DAVICI_KEY_VALUE:
+			if (len < 2)
 			{
-				if (errno == EWOULDBLOCK || errno == EINTR)
-				{
-					return 0;
-				}
-				return -errno;
+				return 2;
 			}
-			req->sent += len;
-		}
-		err = update_ops(c, c->ops | DAVICI_READ);
-		if (err)
-		{
-			return err;
-		}
-		req = req->next;
+			need = 2 + buf[1] + sizeof(uint16_t);
+			if (len < need)
+			{
+				return need;
+			}
+			return need + ((buf[need - 2] << 8) | buf[need - 1]);
+		case DAVICI_LIST_ITEM:
+			need = 1 + sizeof(uint16_t);
+			if (len < need)
+			{
+				return need;
+			}
+			return need + ((buf[1] << 8) | buf[2]);
+		default:
+			return 1;
 	}
-	return update_ops(c, c->ops & ~DAVICI_WRITE);
 }
 
-void davici_disconnect(struct davici_conn *c)
+static int start_stream(struct davici_conn *c, unsigned char type,
+						uint32_t size)
 {
-	struct davici_event *event;
-	struct davici_request *req;
-	void *next;
+	struct davici_stream *s = &c->stream;
 
-	update_ops(c, 0);
-
-	event = c->events;
-	while (event)
+	if (type != DAVICI_CMD_RESPONSE || !c->reqs || !c->reqs->elementcb)
 	{
-		next = event->next;
-		free(event);
-		event = next;
+		return 0;
 	}
-	req = c->reqs;
-	while (req)
+	s->req = pop_request(c, DAVICI_CMD_REQUEST, s->name, sizeof(s->name));
+	if (!s->req)
 	{
-		next = req->next;
-		free(req->buf);
-		free(req);
-		req = next;
+		return -EBADMSG;
 	}
-	close(c->s);
-	free(c);
+	memset(&s->res, 0, sizeof(s->res));
+	s->remaining = size - 1;
+	s->need = 0;
+	s->err = 0;
+	return 1;
 }
 
-static int create_request(enum davici_packet_type type, const char *name,
-						  struct davici_request **rp)
+static int finish_stream(struct davici_conn *c)
 {
-	struct davici_request *req;
-	int err;
+	struct davici_stream *s = &c->stream;
+	struct davici_request *req = s->req;
+	int err = s->err;
 
-	req = calloc(1, sizeof(*req));
-	if (!req)
+	if (!err && (s->res.section || s->res.list))
 	{
-		return -errno;
+		err = -EBADMSG;
 	}
-	req->used = 2;
-	if (name)
-	{
-		req->used += strlen(name);
+	s->req = NULL;
+	s->need = 0;
+	req->cb(c, err, s->name, NULL, req->user);
+	destroy_request(req);
+	return update_write(c);
+}
+
+static int dispatch_stream(struct davici_conn *c, unsigned char *buf,
+						   unsigned int len, unsigned int *consumed)
+{
+	struct davici_stream *s = &c->stream;
+	struct davici_packet pkt;
+	unsigned int pos = 0, skip;
+	int type, err;
+
+	len = min_integer(len, s->remaining);
+	while (s->remaining)
+	{
+		if (s->err < 0)
+		{
+			/* skip the rest of a failed response */
+			skip = min_integer(len - pos, s->remaining);
+			pos += skip;
+			s->remaining -= skip;
+			if (s->remaining)
+			{
+				break;
+			}
+			continue;
+		}
+		s->need = element_len(buf + pos, len - pos);
+		if (s->need > s->remaining)
+		{
+			s->err = -EBADMSG;
+			continue;
+		}
+		if (s->need > len - pos)
+		{
+			break;
+		}
+		pkt.buf = buf + pos;
+		pkt.received = s->need;
+		s->res.pkt = &pkt;
+		s->res.pos = 0;
+		type = davici_parse(&s->res);
+		if (type < 0)
+		{
+			s->err = type;
+		}
+		else
+		{
+			err = s->req->elementcb(&s->res, type, s->req->user);
+			if (err < 0)
+			{
+				s->err = err;
+			}
+		}
+		pos += s->need;
+		s->remaining -= s->need;
+	}
+	*consumed = pos;
+	if (s->remaining)
+	{
+		return 0;
+	}
+	err = finish_stream(c);
+	if (err < 0)
+	{
+		return err;
+	}
+	return 1;
+}
+
+static void consume_budget(struct read_budget *b)
+{
+	if (b->messages != UINT_MAX)
+	{
+		b->messages--;
+	}
+	if (b->deadline && get_time_ns() >= b->deadline)
+	{
+		b->messages = 0;
+	}
+}
+
+static int dispatch_recvbuf(struct davici_conn *c, struct read_budget *b)
+{
+	unsigned int pos = 0, len;
+	uint32_t size;
+	int err = 0;
+
+	c->dispatching++;
+	while (!err && b->messages)
+	{
+		if (c->stream.req)
+		{
+			err = dispatch_stream(c, c->rbuf.buf + pos, c->rbuf.used - pos,
+								  &len);
+			pos += len;
+			if (err <= 0)
+			{
+				break;
+			}
+			err = 0;
+			consume_budget(b);
+			continue;
+		}
+		if (c->rbuf.used - pos < sizeof(size))
+		{
+			break;
+		}
+		memcpy(&size, c->rbuf.buf + pos, sizeof(size));
+		size = ntohl(size);
+		if (size)
+		{
+			if (c->rbuf.used - pos == sizeof(size))
+			{
+				/* wait for the message type to check for streaming */
+				break;
+			}
+			err = start_stream(c, c->rbuf.buf[pos + sizeof(size)], size);
+			if (err > 0)
+			{
+				pos += sizeof(size) + 1;
+				err = 0;
+				continue;
+			}
+			if (err < 0)
+			{
+				break;
+			}
+		}
+		if (c->max_msg && size > c->max_msg)
+		{
+			err = -EMSGSIZE;
+			break;
+		}
+		if (size > c->rbuf.used - pos - sizeof(size))
+		{
+			break;
+		}
+		pos += sizeof(size);
+		if (size)
+		{
+			err = handle_message(c, c->rbuf.buf + pos, size);
+		}
+		count_recvbuf(c, size);
+		pos += size;
+		consume_budget(b);
+	}
+	c->dispatching--;
+	if (pos)
+	{
+		memmove(c->rbuf.buf, c->rbuf.buf + pos, c->rbuf.used - pos);
+		c->rbuf.used -= pos;
+		if (want_shrink(c))
+		{
+			shrink_recvbuf(c);
+		}
+	}
+	return err;
+}
+
+static int has_message(struct davici_conn *c)
+{
+	uint32_t size;
+
+	if (c->stream.req || c->rbuf.used < sizeof(size))
+	{
+		return 0;
+	}
+	memcpy(&size, c->rbuf.buf, sizeof(size));
+	return ntohl(size) <= c->rbuf.used - sizeof(size);
+}
+
+int davici_recv_buf(struct davici_conn *c, void **buf, unsigned int *len)
+{
+	int err;
+
+	err = reserve_recvbuf(c);
+	if (err < 0)
+	{
+		return err;
+	}
+	*buf = c->rbuf.buf + c->rbuf.used;
+	*len = c->rbuf.allocated - c->rbuf.used;
+	return 0;
+}
+
+int davici_recv_done(struct davici_conn *c, unsigned int len)
+{
+	struct read_budget b = {
+		.messages = UINT_MAX,
+	};
+
+	if (len > c->rbuf.allocated - c->rbuf.used)
+	{
+		return -EINVAL;
+	}
+	c->rbuf.used += len;
+	return dispatch_recvbuf(c, &b);
+}
+
+static int read_budget(struct davici_conn *c, struct read_budget *b)
+{
+	int len, err, drained = 0;
+	unsigned int space;
+	void *buf;
+
+	while (1)
+	{
+		err = dispatch_recvbuf(c, b);
+		if (err < 0)
+		{
+			return err;
+		}
+		if (!b->messages)
+		{
+			return !drained || has_message(c);
+		}
+		if (drained)
+		{
+			return 0;
+		}
+		err = davici_recv_buf(c, &buf, &space);
+		if (err < 0)
+		{
+			return err;
+		}
+		len = recv(c->s, buf, space, 0);
+		if (len == -1)
+		{
+			if (errno == EWOULDBLOCK || errno == EINTR)
+			{
+				return 0;
+			}
+			return -errno;
+		}
+		if (len == 0)
+		{
+			return -ECONNRESET;
+		}
+		c->rbuf.used += len;
+		/* a short read indicates that the socket has been drained */
+		drained = (unsigned int)len < space;
+	}
+}
+
+int davici_read(struct davici_conn *c)
+{
+	struct read_budget b = {
+		.messages = UINT_MAX,
+	};
+
+	return flush_deferred(c, read_budget(c, &b));
+}
+
+int davici_read_budget(struct davici_conn *c, unsigned int max_messages,
+					   unsigned long long max_ns)
+{
+	struct read_budget b = {
+		.messages = max_messages ? max_messages : UINT_MAX,
+	};
+
+	if (max_ns)
+	{
+		b.deadline = get_time_ns() + max_ns;
+	}
+	return flush_deferred(c, read_budget(c, &b));
+}
+
+static void set_cork(struct davici_conn *c, int cork)
+{
+#if defined(TCP_CORK)
+	setsockopt(c->s, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+#elif defined(TCP_NOPUSH)
+	setsockopt(c->s, IPPROTO_TCP, TCP_NOPUSH, &cork, sizeof(cork));
+#endif
+}
+
+static int add_iov(struct iovec *iov, unsigned int max, unsigned int *count,
+				   unsigned int *skip, const void *buf, unsigned int len)
+{
+	if (*skip >= len)
+	{
+		*skip -= len;
+		return 1;
+	}
+	if (*count == max)
+	{
+		return 0;
+	}
+	iov[*count].iov_base = (char*)buf + *skip;
+	iov[*count].iov_len = len - *skip;
+	(*count)++;
+	*skip = 0;
+	return 1;
+}
+
+static unsigned int request_iov(struct davici_request *req, struct iovec *iov,
+								unsigned int max, int *complete)
+{
+	unsigned int skip = req->sent, count = 0, pos = 0, i;
+	struct davici_ref *ref;
+
+	*complete = 0;
+	req->hdr = htonl(request_len(req));
+	if (!add_iov(iov, max, &count, &skip, &req->hdr, sizeof(req->hdr)))
+	{
+		return count;
+	}
+	if (req->gen)
+	{
+		/* command name, followed by the window of generated elements */
+		if (!add_iov(iov, max, &count, &skip, req->buf, req->gen_hlen))
+		{
+			return count;
+		}
+		skip -= req->gen_base - req->gen_hlen;
+		if (!add_iov(iov, max, &count, &skip, req->buf + req->gen_hlen,
+					 req->used - req->gen_hlen))
+		{
+			return count;
+		}
+		*complete = req->gen_base + req->used - req->gen_hlen ==
+					req->gen_total;
+		return count;
+	}
+	for (i = 0; i < req->ref_count; i++)
+	{
+		ref = &req->refs[i];
+		if (!add_iov(iov, max, &count, &skip, req->buf + pos,
+					 ref->offset - pos) ||
+			!add_iov(iov, max, &count, &skip, ref->buf, ref->len))
+		{
+			return count;
+		}
+		pos = ref->offset;
+	}
+	if (!add_iov(iov, max, &count, &skip, req->buf + pos, req->used - pos))
+	{
+		return count;
+	}
+	*complete = 1;
+	return count;
+}
+
+unsigned int davici_send_iov(struct davici_conn *c, struct iovec *iov,
+							 unsigned int count)
+{
+	struct davici_request *req;
+	unsigned int i = 0, max;
+	int complete;
+
+	if (!can_send(c))
+	{
+		return 0;
+	}
+	max = UINT_MAX;
+	if (c->window && c->inflight_count < c->window)
+	{
+		max = c->window - c->inflight_count;
+	}
+	else if (c->window)
+	{
+		max = 1;
+	}
+	for (req = c->unsent; req && max-- && i < count; req = req->next)
+	{
+		i += request_iov(req, iov + i, count - i, &complete);
+		if (!complete)
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+static int fill_window(struct davici_request *req)
+{
+	int ret;
+
+	while (req->gen_more && req->used < GEN_WINDOW_LEN)
+	{
+		ret = req->gen(req, req->gen_index++, req->user);
+		if (ret < 0)
+		{
+			return ret;
+		}
+		if (req->err)
+		{
+			return req->err;
+		}
+		req->gen_more = ret > 0;
+	}
+	if (req->ref_count || req->slot_count)
+	{
+		return -EINVAL;
+	}
+	if (req->gen_base + req->used - req->gen_hlen > req->gen_total ||
+		(!req->gen_more &&
+		 req->gen_base + req->used - req->gen_hlen != req->gen_total))
+	{
+		/* generator output differs from measured size */
+		return -EBADMSG;
+	}
+	return 0;
+}
+
+static int refill_window(struct davici_request *req)
+{
+	if (req->sent - sizeof(req->hdr) <
+		req->gen_base + req->used - req->gen_hlen)
+	{
+		return 0;
+	}
+	req->gen_base += req->used - req->gen_hlen;
+	req->used = req->gen_hlen;
+	return fill_window(req);
+}
+
+int davici_send_done(struct davici_conn *c, unsigned int len)
+{
+	struct davici_request *req = c->unsent;
+	unsigned int left;
+	int err = 0;
+
+	while (len && !err)
+	{
+		if (!req)
+		{
+			return -EINVAL;
+		}
+		left = request_len(req) + sizeof(req->hdr) - req->sent;
+		if (len < left)
+		{
+			req->sent += len;
+			if (req->gen && req->sent >= sizeof(req->hdr))
+			{
+				err = refill_window(req);
+			}
+			break;
+		}
+		req->sent += left;
+		len -= left;
+		c->unsent_bytes -= request_len(req) + sizeof(req->hdr);
+		req = req->next;
+		c->unsent = req;
+		c->unsent_count--;
+		c->inflight_count++;
+		c->wanted |= DAVICI_READ;
+	}
+	if (err)
+	{
+		return err;
+	}
+	return update_write(c);
+}
+
+static int send_requests(struct davici_conn *c)
+{
+	struct iovec iov[SEND_IOV_MAX];
+	struct msghdr msg = {
+		.msg_iov = iov,
+	};
+	int corked = 0, err = 0;
+	unsigned int count;
+	ssize_t len;
+
+	while (!err)
+	{
+		count = davici_send_iov(c, iov, SEND_IOV_MAX);
+		if (!count)
+		{
+			break;
+		}
+		if (count == SEND_IOV_MAX && c->tcp && !corked)
+		{
+			/* batch does not fit a single sendmsg(), send full segments */
+			set_cork(c, 1);
+			corked = 1;
+		}
+		msg.msg_iovlen = count;
+		len = sendmsg(c->s, &msg, 0);
+		if (len == -1)
+		{
+			if (errno == EWOULDBLOCK || errno == EINTR)
+			{
+				err = -EAGAIN;
+			}
+			else
+			{
+				err = -errno;
+			}
+			break;
+		}
+		err = davici_send_done(c, len);
+	}
+	if (corked)
+	{
+		set_cork(c, 0);
+	}
+	return err;
+}
+
+static int write_conn(struct davici_conn *c)
+{
+	int err;
+	socklen_t slen = sizeof(err);
+
+	if (c->connecting)
+	{
+		if (getsockopt(c->s, SOL_SOCKET, SO_ERROR, &err, &slen) != 0)
+		{
+			return -errno;
+		}
+		if (err != 0)
+		{
+			return -err;
+		}
+		c->connecting = 0;
+	}
+	err = send_requests(c);
+	if (err == -EAGAIN)
+	{
+		return 0;
+	}
+	if (err)
+	{
+		return err;
+	}
+	return update_write(c);
+}
+
+int davici_write(struct davici_conn *c)
+{
+	return flush_deferred(c, write_conn(c));
+}
+
+void davici_disconnect(struct davici_conn *c)
+{
+	struct davici_event *event;
+	struct davici_request *req;
+	void *next;
+
+	c->wanted = 0;
+	commit_ops(c);
+
+	event = c->events;
+	while (event)
+	{
+		next = event->next;
+		mem_free(event);
+		event = next;
+	}
+	req = c->reqs;
+	while (req)
+	{
+		next = req->next;
+		free_request(req);
+		req = next;
+	}
+	if (c->stream.req)
+	{
+		free_request(c->stream.req);
+	}
+	req = c->pool;
+	while (req)
+	{
+		next = req->next;
+		free_request(req);
+		req = next;
+	}
+	mem_free(c->rbuf.buf);
+	close(c->s);
+	mem_free(c);
+}
+
+static int init_request(struct davici_request *req,
+						enum davici_packet_type type, const char *name)
+{
+	unsigned int used = 2;
+	void *buf;
+
+	if (name)
+	{
+		used += strlen(name);
+	}
+	if (used > req->allocated)
+	{
+		buf = mem_alloc(used);
+		if (!buf)
+		{
+			return -errno;
+		}
+		if (req->buf != req->space)
+		{
+			mem_free(req->buf);
+		}
+		req->buf = buf;
+		req->allocated = used;
+	}
+	req->used = used;
+	req->buf[0] = type;
+	req->buf[1] = used - 2;
+	if (name)
+	{
+		memcpy(req->buf + 2, name, used - 2);
+	}
+	return 0;
+}
+
+static int alloc_request(unsigned int size, struct davici_request **rp)
+{
+	struct davici_request *req;
+
+	req = mem_alloc(sizeof(*req));
+	if (!req)
+	{
+		return -errno;
+	}
+	memset(req, 0, offsetof(struct davici_request, space));
+	req->buf = req->space;
+	req->allocated = REQ_INLINE_LEN;
+	if (size > REQ_INLINE_LEN)
+	{
+		req->buf = mem_alloc(size);
+		if (!req->buf)
+		{
+			mem_free(req);
+			return -errno;
+		}
+		req->allocated = size;
+	}
+	*rp = req;
+	return 0;
+}
+
+static int create_request(enum davici_packet_type type, const char *name,
+						  struct davici_request **rp)
+{
+	struct davici_request *req;
+	int err;
+
+	err = alloc_request(2 + (name ? strlen(name) : 0), &req);
+	if (err < 0)
+	{
+		return err;
+	}
+	err = init_request(req, type, name);
+	if (err < 0)
+	{
+		free_request(req);
+		return err;
+	}
+	*rp = req;
+	return 0;
+}
+
+int davici_new_cmd(const char *cmd, struct davici_request **rp)
+{
+	return create_request(DAVICI_CMD_REQUEST, cmd, rp);
+}
+
+int davici_new_cmd_sized(const char *cmd, unsigned int size,
+						 struct davici_request **rp)
+{
+	struct davici_request *req;
+	int err;
+
+	err = alloc_request(max_integer(size, 2 + strlen(cmd)), &req);
+	if (err < 0)
+	{
+		return err;
+	}
+	err = init_request(req, DAVICI_CMD_REQUEST, cmd);
+	if (err < 0)
+	{
+		free_request(req);
+		return err;
+	}
+	*rp = req;
+	return 0;
+}
+
+int davici_new_measure(const char *cmd, struct davici_request **rp)
+{
+	int err;
+
+	err = create_request(DAVICI_CMD_REQUEST, cmd, rp);
+	if (err < 0)
+	{
+		return err;
+	}
+	(*rp)->measure = 1;
+	return 0;
+}
+
+int davici_new_fragment(struct davici_request **rp)
+{
+	int err;
+
+	err = alloc_request(0, rp);
+	if (err < 0)
+	{
+		return err;
+	}
+	(*rp)->fragment = 1;
+	return 0;
+}
+
+int davici_new_cmd_pooled(struct davici_conn *c, const char *cmd,
+						  struct davici_request **rp)
+{
+	struct davici_request *req;
+	int err;
+
+	req = c->pool;
+	if (!req)
+	{
+		err = create_request(DAVICI_CMD_REQUEST, cmd, &req);
+		if (err < 0)
+		{
+			return err;
+		}
+		req->pool = c;
+		*rp = req;
+		return 0;
+	}
+	err = init_request(req, DAVICI_CMD_REQUEST, cmd);
+	if (err < 0)
+	{
+		return err;
+	}
+	c->pool = req->next;
+	c->pooled--;
+	req->next = NULL;
+	req->sent = 0;
+	req->err = 0;
+	req->cb = NULL;
+	req->elementcb = NULL;
+	req->user = NULL;
+	req->slot_count = 0;
+	*rp = req;
+	return 0;
+}
+
+static int resize_request(struct davici_request *r, unsigned int newlen)
+{
+	void *new;
+
+	if (r->buf == r->space)
+	{
+		new = mem_alloc(newlen);
+		if (new)
+		{
+			memcpy(new, r->buf, r->used);
+		}
+	}
+	else
+	{
+		new = mem_realloc(r->buf, newlen);
+	}
+	if (!new)
+	{
+		return -errno;
+	}
+	r->buf = new;
+	r->allocated = newlen;
+	return 0;
+}
+
+static void* add_element(struct davici_request *r, enum davici_element type,
+						 unsigned int size)
+{
+	unsigned int newlen;
+	void *ret;
+	int err;
+
+	if (r->measure)
+	{
+		r->used += 1 + size;
+		return NULL;
+	}
+	if (r->used + size + 1 > r->allocated)
+	{
+		newlen = r->allocated;
+		while (newlen < r->used + size + 1)
+		{
+			newlen *= 2;
+		}
+		err = resize_request(r, newlen);
+		if (err < 0)
+		{
+			r->err = err;
+			return NULL;
+		}
+	}
+	r->buf[r->used++] = type;
+	ret = r->buf + r->used;
+	r->used += size;
+	return ret;
+}
+
+int davici_reserve(struct davici_request *r, unsigned int size)
+{
+	if (r->err)
+	{
+		return r->err;
+	}
+	if (r->measure || size <= r->allocated - r->used)
+	{
+		return 0;
+	}
+	if (size > UINT_MAX - r->used)
+	{
+		return -EINVAL;
+	}
+	return resize_request(r, r->used + size);
+}
+
+unsigned int davici_request_len(struct davici_request *r)
+{
+	return request_len(r);
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *buf, size_t len)
+{
+	const unsigned char *pos = buf;
+
+	while (len--)
+	{
+		hash ^= *pos++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+int davici_request_hash(struct davici_request *r, uint64_t *hash)
+{
+	unsigned int i, pos = 0;
+	uint64_t h = FNV_BASIS;
+
+	if (r->err)
+	{
+		return r->err;
+	}
+	if (r->measure || r->slot_count || r->gen)
+	{
+		return -EINVAL;
+	}
+	for (i = 0; i < r->ref_count; i++)
+	{
+		h = fnv1a(h, r->buf + pos, r->refs[i].offset - pos);
+		h = fnv1a(h, r->refs[i].buf, r->refs[i].len);
+		pos = r->refs[i].offset;
+	}
+	*hash = fnv1a(h, r->buf + pos, r->used - pos);
+	return 0;
+}
+
+void davici_section_start(struct davici_request *r, const char *name)
+{
+	uint8_t nlen;
+	char *pos;
+
+	nlen = strlen(name);
+	pos = add_element(r, DAVICI_SECTION_START, 1 + nlen);
+	if (pos)
+	{
+		pos[0] = nlen;
+		memcpy(pos + 1, name, nlen);
+	}
+}
+
+void davici_section_end(struct davici_request *r)
+{
+	add_element(r, DAVICI_SECTION_END, 0);
+}
+
+static unsigned char* add_value(struct davici_request *r, const char *name,
+								unsigned int len)
+{
+	unsigned char *pos;
+	uint16_t vlen;
+	uint8_t nlen;
+
+	if (len > UINT16_MAX)
+	{
+		r->err = -EINVAL;
+		return NULL;
+	}
+	vlen = htons(len);
+	if (name)
+	{
+		nlen = strlen(name);
+		pos = add_element(r, DAVICI_KEY_VALUE, 1 + nlen + sizeof(vlen) + len);
+		if (!pos)
+		{
+			return NULL;
+		}
+		pos[0] = nlen;
+		memcpy(pos + 1, name, nlen);
+		pos += 1 + nlen;
+	}
+	else
+	{
+		pos = add_element(r, DAVICI_LIST_ITEM, sizeof(vlen) + len);
+		if (!pos)
+		{
+			return NULL;
+		}
+	}
+	memcpy(pos, &vlen, sizeof(vlen));
+	return pos + sizeof(vlen);
+}
+
+static void add_vformat(struct davici_request *r, const char *name,
+						const char *fmt, va_list args)
+{
+	unsigned int hdr, avail = 0;
+	unsigned char *pos, save;
+	va_list copy;
+	int len, err;
+
+	hdr = 1 + sizeof(uint16_t);
+	if (name)
+	{
+		hdr += 1 + (uint8_t)strlen(name);
+	}
+	if (!r->measure && r->allocated > r->used + hdr)
+	{
+		avail = r->allocated - r->used - hdr;
+	}
+	/* try to format the value in place, behind its element header */
+	va_copy(copy, args);
+	len = vsnprintf(avail ? (char*)r->buf + r->used + hdr : NULL, avail,
+					fmt, copy);
+	va_end(copy);
+	if (len < 0)
+	{
+		r->err = -errno;
+		return;
+	}
+	if ((unsigned int)len < avail)
+	{
+		add_value(r, name, len);
+		return;
+	}
+	err = davici_reserve(r, hdr + len);
+	if (err < 0)
+	{
+		r->err = err;
+		return;
+	}
+	pos = add_value(r, name, len);
+	if (!pos || !len)
+	{
+		return;
+	}
+	if (r->used < r->allocated)
+	{
+		vsnprintf((char*)pos, len + 1, fmt, args);
+	}
+	else
+	{
+		/* no space for the terminating null, format over the header */
+		save = pos[-1];
+		vsnprintf((char*)pos - 1, len + 1, fmt, args);
+		memmove(pos, pos - 1, len);
+		pos[-1] = save;
+	}
+}
+
+static unsigned int u64_len(uint64_t value)
+{
+	unsigned int len = 1;
+
+	while (value >= 10)
+	{
+		value /= 10;
+		len++;
+	}
+	return len;
+}
+
+static void put_u64(unsigned char *pos, unsigned int len, uint64_t value)
+{
+	while (len--)
+	{
+		pos[len] = '0' + value % 10;
+		value /= 10;
+	}
+}
+
+static void add_u64(struct davici_request *r, const char *name,
+					uint64_t value)
+{
+	unsigned char *pos;
+	unsigned int len;
+
+	len = u64_len(value);
+	pos = add_value(r, name, len);
+	if (pos)
+	{
+		put_u64(pos, len, value);
+	}
+}
+
+static void add_i64(struct davici_request *r, const char *name,
+					int64_t value)
+{
+	unsigned char *pos;
+	unsigned int len;
+	uint64_t abs;
+
+	if (value >= 0)
+	{
+		add_u64(r, name, value);
+		return;
+	}
+	abs = -(uint64_t)value;
+	len = u64_len(abs);
+	pos = add_value(r, name, 1 + len);
+	if (pos)
+	{
+		pos[0] = '-';
+		put_u64(pos + 1, len, abs);
+	}
+}
+
+static void add_bool(struct davici_request *r, const char *name, int value)
+{
+	const char *str = value ? "yes" : "no";
+	unsigned char *pos;
+
+	pos = add_value(r, name, strlen(str));
+	if (pos)
+	{
+		memcpy(pos, str, strlen(str));
+	}
+}
+
+static void add_inaddr(struct davici_request *r, const char *name,
+					   const struct sockaddr *addr)
+{
+	char buf[INET6_ADDRSTRLEN];
+	unsigned char *pos;
+	const void *in;
+
+	switch (addr->sa_family)
+	{
+		case AF_INET:
+			in = &((const struct sockaddr_in*)addr)->sin_addr;
+			break;
+		case AF_INET6:
+			in = &((const struct sockaddr_in6*)addr)->sin6_addr;
+			break;
+		default:
+			r->err = -EAFNOSUPPORT;
+			return;
+	}
+	if (!inet_ntop(addr->sa_family, in, buf, sizeof(buf)))
+	{
+		r->err = -errno;
+		return;
+	}
+	pos = add_value(r, name, strlen(buf));
+	if (pos)
+	{
+		memcpy(pos, buf, strlen(buf));
+	}
+}
+
+static void add_hex(struct davici_request *r, const char *name,
+					const void *buf, unsigned int buflen)
+{
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *in = buf;
+	unsigned char *pos;
+	unsigned int i;
+
+	if (buflen > UINT16_MAX / 2)
+	{
+		r->err = -EINVAL;
+		return;
+	}
+	pos = add_value(r, name, buflen * 2);
+	if (pos)
+	{
+		for (i = 0; i < buflen; i++)
+		{
+			*pos++ = hex[in[i] >> 4];
+			*pos++ = hex[in[i] & 0x0f];
+		}
+	}
+}
+
+void davici_kv_u64(struct davici_request *r, const char *name,
+				   uint64_t value)
+{
+	add_u64(r, name, value);
+}
+
+void davici_kv_i64(struct davici_request *r, const char *name,
+				   int64_t value)
+{
+	add_i64(r, name, value);
+}
+
+void davici_kv_bool(struct davici_request *r, const char *name, int value)
+{
+	add_bool(r, name, value);
+}
+
+void davici_kv_inaddr(struct davici_request *r, const char *name,
+					  const struct sockaddr *addr)
+{
+	add_inaddr(r, name, addr);
+}
+
+void davici_kv_hex(struct davici_request *r, const char *name,
+				   const void *buf, unsigned int buflen)
+{
+	add_hex(r, name, buf, buflen);
+}
+
+void davici_list_item_u64(struct davici_request *r, uint64_t value)
+{
+	add_u64(r, NULL, value);
+}
+
+void davici_list_item_i64(struct davici_request *r, int64_t value)
+{
+	add_i64(r, NULL, value);
+}
+
+void davici_list_item_bool(struct davici_request *r, int value)
+{
+	add_bool(r, NULL, value);
+}
+
+void davici_list_item_inaddr(struct davici_request *r,
+							 const struct sockaddr *addr)
+{
+	add_inaddr(r, NULL, addr);
+}
+
+void davici_list_item_hex(struct davici_request *r, const void *buf,
+						  unsigned int buflen)
+{
+	add_hex(r, NULL, buf, buflen);
+}
+
+static void add_ref(struct davici_request *r, const char *name,
+					const void *buf, unsigned int buflen,
+					davici_releasecb release, void *user)
+{
+	struct davici_ref *new;
+	unsigned int count;
+
+	if (buflen > UINT16_MAX || buflen > UINT_MAX - request_len(r))
+	{
+		r->err = -EINVAL;
+	}
+	if (!r->err && !r->measure && r->ref_count == r->ref_allocated)
+	{
+		count = max_integer(4, r->ref_allocated * 2);
+		new = mem_realloc(r->refs, count * sizeof(*new));
+		if (new)
+		{
+			r->refs = new;
+			r->ref_allocated = count;
+		}
+		else
+		{
+			r->err = -errno;
+		}
+	}
+	/* encode the element header with an empty value, referencing buf */
+	if (!r->err && add_value(r, name, 0) && !r->err)
+	{
+		r->refs[r->ref_count++] = (struct davici_ref){
+			.offset = r->used,
+			.buf = buf,
+			.len = buflen,
+			.release = release,
+			.user = user,
+		};
+		r->buf[r->used - 2] = buflen >> 8;
+		r->buf[r->used - 1] = buflen & 0xff;
+		r->ref_len += buflen;
+		return;
+	}
+	if (r->measure)
+	{
+		r->used += buflen;
+	}
+	if (release)
+	{
+		release(buf, buflen, user);
+	}
+}
+
+void davici_kv_ref(struct davici_request *r, const char *name,
+				   const void *buf, unsigned int buflen,
+				   davici_releasecb release, void *user)
+{
+	add_ref(r, name, buf, buflen, release, user);
+}
+
+void davici_list_item_ref(struct davici_request *r, const void *buf,
+						  unsigned int buflen, davici_releasecb release,
+						  void *user)
+{
+	add_ref(r, NULL, buf, buflen, release, user);
+}
+
+static void unmap_file(const void *buf, unsigned int len, void *user)
+{
+	uintptr_t base, page = sysconf(_SC_PAGESIZE);
+
+	base = (uintptr_t)buf & ~(page - 1);
+	munmap((void*)base, len + ((uintptr_t)buf - base));
+}
+
+static void add_file(struct davici_request *r, const char *name,
+					 int fd, off_t offset, unsigned int len)
+{
+	off_t page = sysconf(_SC_PAGESIZE), base;
+	struct stat st;
+	void *map;
+
+	if (r->measure || !len)
+	{
+		add_ref(r, name, "", len, NULL, NULL);
+		return;
+	}
+	if (len > UINT16_MAX || offset < 0)
+	{
+		r->err = -EINVAL;
+		return;
+	}
+	if (fstat(fd, &st) != 0)
+	{
+		r->err = -errno;
+		return;
+	}
+	/* accessing a mapping beyond the end of the file raises SIGBUS */
+	if (offset > st.st_size || len > st.st_size - offset)
+	{
+		r->err = -EINVAL;
+		return;
+	}
+	/* mmap() requires a page aligned offset */
+	base = offset & ~(page - 1);
+	map = mmap(NULL, len + (offset - base), PROT_READ, MAP_SHARED, fd, base);
+	if (map == MAP_FAILED)
+	{
+		r->err = -errno;
+		return;
+	}
+	add_ref(r, name, (char*)map + (offset - base), len, unmap_file, NULL);
+}
+
+void davici_kv_file(struct davici_request *r, const char *name,
+					int fd, off_t offset, unsigned int len)
+{
+	add_file(r, name, fd, offset, len);
+}
+
+void davici_list_item_file(struct davici_request *r, int fd, off_t offset,
+						   unsigned int len)
+{
+	add_file(r, NULL, fd, offset, len);
+}
+
+void davici_kv(struct davici_request *r, const char *name,
+			   const void *buf, unsigned int buflen)
+{
+	uint8_t nlen;
+	uint16_t vlen;
+	char *pos;
+
+	nlen = strlen(name);
+	pos = add_element(r, DAVICI_KEY_VALUE, 1 + nlen + sizeof(vlen) + buflen);
+	if (pos)
+	{
+		pos[0] = nlen;
+		memcpy(pos + 1, name, nlen);
+		vlen = htons(buflen);
+		memcpy(pos + 1 + nlen, &vlen, sizeof(vlen));
+		memcpy(pos + 1 + nlen + sizeof(vlen), buf, buflen);
+	}
+}
+
+static void add_slot(struct davici_request *r)
+{
+	unsigned int *new, count;
+
+	if (r->err || r->measure)
+	{
+		return;
+	}
+	if (r->slot_count == r->slot_allocated)
+	{
+		count = max_integer(4, r->slot_allocated * 2);
+		new = mem_realloc(r->slots, count * sizeof(*new));
+		if (!new)
+		{
+			r->err = -errno;
+			return;
+		}
+		r->slots = new;
+		r->slot_allocated = count;
+	}
+	/* slots point to the value length of an empty value at the tail */
+	r->slots[r->slot_count++] = r->used - sizeof(uint16_t);
+}
+
+void davici_kv_slot(struct davici_request *r, const char *name)
+{
+	davici_kv(r, name, "", 0);
+	add_slot(r);
+}
+
+void davici_kvf(struct davici_request *r, const char *name,
+				const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	davici_vkvf(r, name, fmt, args);
+	va_end(args);
+}
+
+void davici_vkvf(struct davici_request *r, const char *name,
+				 const char *fmt, va_list args)
+{
+	add_vformat(r, name, fmt, args);
+}
+
+void davici_list_start(struct davici_request *r, const char *name)
+{
+	uint8_t nlen;
+	char *pos;
+
+	nlen = strlen(name);
+	pos = add_element(r, DAVICI_LIST_START, 1 + nlen);
+	if (pos)
+	{
+		pos[0] = nlen;
+		memcpy(pos + 1, name, nlen);
+	}
+}
+
+void davici_list_item(struct davici_request *r, const void *buf,
+					  unsigned int buflen)
+{
+	uint16_t vlen;
+	char *pos;
+
+	pos = add_element(r, DAVICI_LIST_ITEM, sizeof(vlen) + buflen);
+	if (pos)
+	{
+		vlen = htons(buflen);
+		memcpy(pos, &vlen, sizeof(vlen));
+		memcpy(pos + sizeof(vlen), buf, buflen);
+	}
+}
+
+void davici_list_itemf(struct davici_request *r, const char *fmt, ...)
+{
+
+	va_list args;
+
+	va_start(args, fmt);
+	davici_list_vitemf(r, fmt, args);
+	va_end(args);
+}
+
+void davici_list_vitemf(struct davici_request *r, const char *fmt, va_list args)
+{
+	add_vformat(r, NULL, fmt, args);
+}
+
+void davici_list_item_slot(struct davici_request *r)
+{
+	davici_list_item(r, "", 0);
+	add_slot(r);
+}
+
+int davici_instantiate(const struct davici_request *tmpl,
+					   const struct davici_slot *values, unsigned int count,
+					   struct davici_request **rp)
+{
+	struct davici_request *req;
+	unsigned int i, size, pos = 0;
+	unsigned char *out;
+	uint16_t vlen;
+	int err;
+
+	if (tmpl->err)
+	{
+		return tmpl->err;
+	}
+	if (count != tmpl->slot_count || tmpl->ref_count || tmpl->fragment ||
+		tmpl->measure || tmpl->gen)
+	{
+		return -EINVAL;
+	}
+	size = tmpl->used;
+	for (i = 0; i < count; i++)
+	{
+		if (values[i].len > UINT16_MAX)
+		{
+			return -EINVAL;
+		}
+		size += values[i].len;
+	}
+	err = alloc_request(size, &req);
+	if (err < 0)
+	{
+		return err;
+	}
+	out = req->buf;
+	for (i = 0; i < count; i++)
+	{
+		memcpy(out, tmpl->buf + pos, tmpl->slots[i] - pos);
+		out += tmpl->slots[i] - pos;
+		vlen = htons(values[i].len);
+		memcpy(out, &vlen, sizeof(vlen));
+		out += sizeof(vlen);
+		memcpy(out, values[i].buf, values[i].len);
+		out += values[i].len;
+		pos = tmpl->slots[i] + sizeof(vlen);
+	}
+	memcpy(out, tmpl->buf + pos, tmpl->used - pos);
+	req->used = size;
+	*rp = req;
+	return 0;
+}
+
+static unsigned int desc_len(const struct davici_desc *desc)
+{
+	switch (desc->type)
+	{
+		case DAVICI_SECTION_START:
+		case DAVICI_LIST_START:
+			if (desc->namelen > UINT8_MAX)
+			{
+				return 0;
+			}
+			return 2 + desc->namelen;
+		case DAVICI_KEY_VALUE:
+			if (desc->namelen > UINT8_MAX || desc->valuelen > UINT16_MAX)
+			{
+				return 0;
+			}
+			return 2 + desc->namelen + sizeof(uint16_t) + desc->valuelen;
+		case DAVICI_LIST_ITEM:
+			if (desc->valuelen > UINT16_MAX)
+			{
+				return 0;
+			}
+			return 1 + sizeof(uint16_t) + desc->valuelen;
+		case DAVICI_SECTION_END:
+		case DAVICI_LIST_END:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+int davici_add_table(struct davici_request *r, const struct davici_desc *descs,
+					 unsigned int count)
+{
+	unsigned int i, len, size = 0;
+	unsigned char *pos;
+	uint16_t vlen;
+	int err;
+
+	if (r->err)
+	{
+		return r->err;
+	}
+	for (i = 0; i < count; i++)
+	{
+		len = desc_len(&descs[i]);
+		if (!len || len > UINT_MAX - size)
+		{
+			return -EINVAL;
+		}
+		size += len;
+	}
+	if (r->measure)
+	{
+		r->used += size;
+		return 0;
+	}
+	err = davici_reserve(r, size);
+	if (err < 0)
+	{
+		r->err = err;
+		return err;
 	}
-	req->allocated = max_integer(32, req->used);
-	req->buf = malloc(req->allocated);
-	if (!req->buf)
+	pos = r->buf + r->used;
+	for (i = 0; i < count; i++)
 	{
-		err = -errno;
-		free(req);
+		*pos++ = descs[i].type;
+		if (descs[i].type == DAVICI_SECTION_START ||
+			descs[i].type == DAVICI_LIST_START ||
+			descs[i].type == DAVICI_KEY_VALUE)
+		{
+			*pos++ = descs[i].namelen;
+			memcpy(pos, descs[i].name, descs[i].namelen);
+			pos += descs[i].namelen;
+		}
+		if (descs[i].type == DAVICI_KEY_VALUE ||
+			descs[i].type == DAVICI_LIST_ITEM)
+		{
+			vlen = htons(descs[i].valuelen);
+			memcpy(pos, &vlen, sizeof(vlen));
+			pos += sizeof(vlen);
+			memcpy(pos, descs[i].value, descs[i].valuelen);
+			pos += descs[i].valuelen;
+		}
+	}
+	r->used += size;
+	return 0;
+}
+
+void davici_list_end(struct davici_request *r)
+{
+	add_element(r, DAVICI_LIST_END, 0);
+}
+
+void davici_cancel(struct davici_request *r)
+{
+	destroy_request(r);
+}
+
+static void append_req(struct davici_conn *c, struct davici_request *r)
+{
+	if (c->tail)
+	{
+		c->tail->next = r;
+	}
+	else
+	{
+		c->reqs = r;
+	}
+	c->tail = r;
+	if (!c->unsent)
+	{
+		c->unsent = r;
+	}
+	c->unsent_count++;
+	c->unsent_bytes += request_len(r) + sizeof(r->hdr);
+}
+
+static int check_unsent(struct davici_conn *c, struct davici_request *r)
+{
+	if (c->max_unsent && (c->unsent_bytes > c->max_unsent ||
+		request_len(r) + sizeof(r->hdr) > c->max_unsent - c->unsent_bytes))
+	{
+		return -ENOBUFS;
+	}
+	return 0;
+}
+
+int davici_queue(struct davici_conn *c, struct davici_request *r,
+				 davici_cb cmd_cb, void *user)
+{
+	int err;
+
+	if (r->err || r->slot_count || r->measure || r->fragment)
+	{
+		err = r->err ? r->err : -EINVAL;
+		davici_cancel(r);
 		return err;
 	}
-	req->buf[0] = type;
-	req->buf[1] = req->used - 2;
-	if (name)
+	err = check_unsent(c, r);
+	if (err)
 	{
-		memcpy(req->buf + 2, name, req->used - 2);
+		davici_cancel(r);
+		return err;
 	}
-	*rp = req;
+	r->cb = cmd_cb;
+	r->user = user;
+
+	append_req(c, r);
+
+	return update_write(c);
+}
+
+int davici_freeze(struct davici_request *r, struct davici_message **msgp)
+{
+	struct davici_message *msg;
+	int err;
+
+	if (r->err || r->slot_count || r->measure || r->ref_count ||
+		r->fragment)
+	{
+		err = r->err ? r->err : -EINVAL;
+		davici_cancel(r);
+		return err;
+	}
+	if (r->buf == r->space)
+	{
+		msg = mem_alloc(sizeof(*msg) + r->used);
+		if (!msg)
+		{
+			err = -errno;
+			davici_cancel(r);
+			return err;
+		}
+		memcpy(msg->data, r->buf, r->used);
+		msg->buf = msg->data;
+	}
+	else
+	{
+		msg = mem_alloc(sizeof(*msg));
+		if (!msg)
+		{
+			err = -errno;
+			davici_cancel(r);
+			return err;
+		}
+		/* take over the request buffer without copying it */
+		msg->buf = r->buf;
+		r->buf = r->space;
+		r->allocated = REQ_INLINE_LEN;
+	}
+	msg->refs = 1;
+	msg->len = r->used;
+	msg->cache = NULL;
+	davici_cancel(r);
+	*msgp = msg;
 	return 0;
 }
 
-int davici_new_cmd(const char *cmd, struct davici_request **rp)
+struct davici_message* davici_message_ref(struct davici_message *msg)
 {
-	return create_request(DAVICI_CMD_REQUEST, cmd, rp);
+	__atomic_add_fetch(&msg->refs, 1, __ATOMIC_RELAXED);
+	return msg;
 }
 
-static void* add_element(struct davici_request *r, enum davici_element type,
-						 unsigned int size)
+static void cache_unref(struct davici_cache *cache)
 {
-	unsigned int newlen;
-	void *ret, *new;
+	if (__atomic_sub_fetch(&cache->refs, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		munmap(cache->map, cache->size);
+		mem_free(cache);
+	}
+}
 
-	if (r->used + size + 1 > r->allocated)
+void davici_message_unref(struct davici_message *msg)
+{
+	if (__atomic_sub_fetch(&msg->refs, 1, __ATOMIC_ACQ_REL) == 0)
 	{
-		newlen = r->allocated;
-		while (newlen < r->used + size + 1)
+		if (msg->cache)
 		{
-			newlen *= 2;
+			cache_unref(msg->cache);
 		}
-		new = realloc(r->buf, newlen);
-		if (!new)
+		else if (msg->buf != msg->data)
 		{
-			r->err = -errno;
-			return NULL;
+			mem_free(msg->buf);
 		}
-		r->buf = new;
-		r->allocated = newlen;
+		mem_free(msg);
 	}
-	r->buf[r->used++] = type;
-	ret = r->buf + r->used;
-	r->used += size;
-	return ret;
 }
 
-void davici_section_start(struct davici_request *r, const char *name)
+int davici_queue_message(struct davici_conn *c, struct davici_message *msg,
+						 davici_cb cmd_cb, void *user)
 {
-	uint8_t nlen;
-	char *pos;
+	struct davici_request *req;
+	int err;
 
-	nlen = strlen(name);
-	pos = add_element(r, DAVICI_SECTION_START, 1 + nlen);
-	if (pos)
+	err = alloc_request(0, &req);
+	if (err < 0)
 	{
-		pos[0] = nlen;
-		memcpy(pos + 1, name, nlen);
+		return err;
 	}
+	req->msg = davici_message_ref(msg);
+	req->buf = msg->buf;
+	req->allocated = req->used = msg->len;
+	return davici_queue(c, req, cmd_cb, user);
 }
 
-void davici_section_end(struct davici_request *r)
+static int write_all(int fd, const void *buf, size_t len)
 {
-	add_element(r, DAVICI_SECTION_END, 0);
+	ssize_t ret;
+
+	while (len)
+	{
+		ret = write(fd, buf, len);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -errno;
+		}
+		buf = (const char*)buf + ret;
+		len -= ret;
+	}
+	return 0;
 }
 
-void davici_kv(struct davici_request *r, const char *name,
-			   const void *buf, unsigned int buflen)
+static int write_cache(int fd, uint32_t tag,
+					   struct davici_message *const *msgs, unsigned int count)
 {
-	uint8_t nlen;
-	uint16_t vlen;
-	char *pos;
+	struct davici_cache_header hdr;
+	uint64_t hash = FNV_BASIS;
+	unsigned int i;
+	uint32_t len;
+	int err;
 
-	nlen = strlen(name);
-	pos = add_element(r, DAVICI_KEY_VALUE, 1 + nlen + sizeof(vlen) + buflen);
-	if (pos)
+	for (i = 0; i < count; i++)
 	{
-		pos[0] = nlen;
-		memcpy(pos + 1, name, nlen);
-		vlen = htons(buflen);
-		memcpy(pos + 1 + nlen, &vlen, sizeof(vlen));
-		memcpy(pos + 1 + nlen + sizeof(vlen), buf, buflen);
+		len = htonl(msgs[i]->len);
+		hash = fnv1a(hash, &len, sizeof(len));
+		hash = fnv1a(hash, msgs[i]->buf, msgs[i]->len);
+	}
+	hdr.magic = htonl(CACHE_MAGIC);
+	hdr.version = htonl(CACHE_VERSION);
+	hdr.tag = htonl(tag);
+	hdr.count = htonl(count);
+	hdr.checksum[0] = htonl(hash >> 32);
+	hdr.checksum[1] = htonl(hash);
+	err = write_all(fd, &hdr, sizeof(hdr));
+	for (i = 0; i < count && err == 0; i++)
+	{
+		len = htonl(msgs[i]->len);
+		err = write_all(fd, &len, sizeof(len));
+		if (err == 0)
+		{
+			err = write_all(fd, msgs[i]->buf, msgs[i]->len);
+		}
+	}
+	if (err == 0 && fsync(fd) != 0)
+	{
+		err = -errno;
+	}
+	return err;
+}
+
+int davici_cache_write(const char *path, uint32_t tag,
+					   struct davici_message *const *msgs, unsigned int count)
+{
+	char *tmp;
+	size_t len;
+	int fd, err;
+
+	len = strlen(path) + sizeof(".tmp");
+	tmp = mem_alloc(len);
+	if (!tmp)
+	{
+		return -errno;
+	}
+	snprintf(tmp, len, "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+	{
+		err = -errno;
+		mem_free(tmp);
+		return err;
+	}
+	err = write_cache(fd, tag, msgs, count);
+	if (close(fd) != 0 && err == 0)
+	{
+		err = -errno;
+	}
+	/* replace any existing cache atomically */
+	if (err == 0 && rename(tmp, path) != 0)
+	{
+		err = -errno;
+	}
+	if (err < 0)
+	{
+		unlink(tmp);
+	}
+	mem_free(tmp);
+	return err;
+}
+
+static int index_cache(struct davici_cache *cache,
+					   const struct davici_cache_header *hdr)
+{
+	uint64_t hash = FNV_BASIS;
+	size_t pos = sizeof(*hdr);
+	unsigned int i;
+	uint32_t len;
+
+	hash = fnv1a(hash, cache->map + pos, cache->size - pos);
+	if (ntohl(hdr->checksum[0]) != (uint32_t)(hash >> 32) ||
+		ntohl(hdr->checksum[1]) != (uint32_t)hash)
+	{
+		return -EBADMSG;
+	}
+	for (i = 0; i < cache->count; i++)
+	{
+		if (cache->size - pos < sizeof(len))
+		{
+			return -EBADMSG;
+		}
+		memcpy(&len, cache->map + pos, sizeof(len));
+		len = ntohl(len);
+		pos += sizeof(len);
+		/* expect a command request with a command name */
+		if (len < 2 || len > cache->size - pos ||
+			cache->map[pos] != DAVICI_CMD_REQUEST ||
+			cache->map[pos + 1] > len - 2 || pos > UINT_MAX)
+		{
+			return -EBADMSG;
+		}
+		cache->offsets[i] = pos;
+		pos += len;
+	}
+	if (pos != cache->size)
+	{
+		return -EBADMSG;
+	}
+	return 0;
+}
+
+int davici_cache_open(const char *path, uint32_t tag,
+					  struct davici_cache **cachep)
+{
+	struct davici_cache_header hdr;
+	struct davici_cache *cache;
+	struct stat st;
+	void *map;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return -errno;
+	}
+	if (fstat(fd, &st) != 0)
+	{
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	if (st.st_size < (off_t)sizeof(hdr))
+	{
+		close(fd);
+		return -EBADMSG;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	err = -errno;
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		return err;
+	}
+	memcpy(&hdr, map, sizeof(hdr));
+	if (ntohl(hdr.magic) != CACHE_MAGIC || ntohl(hdr.version) != CACHE_VERSION)
+	{
+		munmap(map, st.st_size);
+		return -EPROTO;
+	}
+	if (ntohl(hdr.tag) != tag)
+	{
+		munmap(map, st.st_size);
+		return -ESTALE;
+	}
+	if (ntohl(hdr.count) > (st.st_size - sizeof(hdr)) / sizeof(uint32_t))
+	{
+		munmap(map, st.st_size);
+		return -EBADMSG;
+	}
+	cache = mem_alloc(sizeof(*cache) +
+					  ntohl(hdr.count) * sizeof(cache->offsets[0]));
+	if (!cache)
+	{
+		err = -errno;
+		munmap(map, st.st_size);
+		return err;
+	}
+	cache->refs = 1;
+	cache->count = ntohl(hdr.count);
+	cache->size = st.st_size;
+	cache->map = map;
+	err = index_cache(cache, &hdr);
+	if (err < 0)
+	{
+		cache_unref(cache);
+		return err;
+	}
+	*cachep = cache;
+	return 0;
+}
+
+unsigned int davici_cache_count(struct davici_cache *cache)
+{
+	return cache->count;
+}
+
+int davici_cache_get(struct davici_cache *cache, unsigned int index,
+					 struct davici_message **msgp)
+{
+	struct davici_message *msg;
+	uint32_t len;
+
+	if (index >= cache->count)
+	{
+		return -ENOENT;
+	}
+	msg = mem_alloc(sizeof(*msg));
+	if (!msg)
+	{
+		return -errno;
+	}
+	memcpy(&len, cache->map + cache->offsets[index] - sizeof(len),
+		   sizeof(len));
+	msg->refs = 1;
+	msg->len = ntohl(len);
+	msg->buf = cache->map + cache->offsets[index];
+	msg->cache = cache;
+	__atomic_add_fetch(&cache->refs, 1, __ATOMIC_RELAXED);
+	*msgp = msg;
+	return 0;
+}
+
+void davici_cache_close(struct davici_cache *cache)
+{
+	cache_unref(cache);
+}
+
+int davici_queue_generated(struct davici_conn *c, const char *cmd,
+						   davici_generatecb gen, davici_cb cmd_cb,
+						   void *user)
+{
+	struct davici_request *req;
+	unsigned int index = 0;
+	int err, ret;
+
+	err = davici_new_measure(cmd, &req);
+	if (err < 0)
+	{
+		return err;
+	}
+	do
+	{
+		ret = gen(req, index++, user);
+	}
+	while (ret > 0 && !req->err);
+	err = req->err ? req->err : ret;
+	ret = request_len(req);
+	davici_cancel(req);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	err = davici_new_cmd_sized(cmd, GEN_WINDOW_LEN, &req);
+	if (err < 0)
+	{
+		return err;
+	}
+	req->gen = gen;
+	req->user = user;
+	req->gen_hlen = req->gen_base = req->used;
+	req->gen_total = ret;
+	req->gen_more = 1;
+	err = fill_window(req);
+	if (err < 0)
+	{
+		davici_cancel(req);
+		return err;
 	}
+	return davici_queue(c, req, cmd_cb, user);
 }
 
-void davici_kvf(struct davici_request *r, const char *name,
-				const char *fmt, ...)
+int davici_queue_incremental(struct davici_conn *c, struct davici_request *r,
+							 davici_elementcb elementcb, davici_cb cmd_cb,
+							 void *user)
 {
-	va_list args;
-
-	va_start(args, fmt);
-	davici_vkvf(r, name, fmt, args);
-	va_end(args);
+	r->elementcb = elementcb;
+	return davici_queue(c, r, cmd_cb, user);
 }
 
-void davici_vkvf(struct davici_request *r, const char *name,
-				 const char *fmt, va_list args)
+int davici_queue_streamed(struct davici_conn *c, struct davici_request *r,
+						  davici_cb cmd_cb, const char *event,
+						  davici_cb event_cb, void *user)
 {
-	char buf[512], *m = buf;
-	va_list copy;
-	int len;
+	int err;
 
-	va_copy(copy, args);
-	len = vsnprintf(buf, sizeof(buf), fmt, copy);
-	va_end(copy);
-	if (len >= (int)sizeof(buf))
-	{
-		m = malloc(len + 1);
-		if (m)
-		{
-			len = vsnprintf(m, len + 1, fmt, args);
-		}
-		else
-		{
-			len = -1;
-		}
-	}
-	if (len < 0)
-	{
-		r->err = -errno;
-	}
-	else
+	if (r->err)
 	{
-		davici_kv(r, name, m, len);
+		err = r->err;
+		davici_cancel(r);
+		return err;
 	}
-	if (m != buf)
+	err = davici_register(c, event, event_cb, user);
+	if (err)
 	{
-		free(m);
+		return err;
 	}
+	err = davici_queue(c, r, cmd_cb, user);
+	davici_unregister(c, event, event_cb, user);
+	return err;
 }
 
-void davici_list_start(struct davici_request *r, const char *name)
+void davici_batch_begin(struct davici_conn *c)
 {
-	uint8_t nlen;
-	char *pos;
+	c->batch++;
+}
 
-	nlen = strlen(name);
-	pos = add_element(r, DAVICI_LIST_START, 1 + nlen);
-	if (pos)
+int davici_batch_commit(struct davici_conn *c)
+{
+	if (c->batch && --c->batch)
 	{
-		pos[0] = nlen;
-		memcpy(pos + 1, name, nlen);
+		return 0;
 	}
+	return commit_ops(c);
 }
 
-void davici_list_item(struct davici_request *r, const void *buf,
-					  unsigned int buflen)
+int davici_set_deferred_ops(struct davici_conn *c, int deferred)
 {
-	uint16_t vlen;
-	char *pos;
-
-	pos = add_element(r, DAVICI_LIST_ITEM, sizeof(vlen) + buflen);
-	if (pos)
+	c->deferred = deferred;
+	if (deferred || c->batch)
 	{
-		vlen = htons(buflen);
-		memcpy(pos, &vlen, sizeof(vlen));
-		memcpy(pos + sizeof(vlen), buf, buflen);
+		return 0;
 	}
+	return commit_ops(c);
 }
 
-void davici_list_itemf(struct davici_request *r, const char *fmt, ...)
+int davici_flush_ops(struct davici_conn *c)
 {
-
-	va_list args;
-
-	va_start(args, fmt);
-	davici_list_vitemf(r, fmt, args);
-	va_end(args);
+	if (c->batch)
+	{
+		return 0;
+	}
+	return commit_ops(c);
 }
 
-void davici_list_vitemf(struct davici_request *r, const char *fmt, va_list args)
+static void sync_cb(struct davici_conn *c, int err, const char *name,
+					struct davici_response *res, void *user)
 {
-	char buf[512], *m = buf;
-	va_list copy;
-	int len;
+	struct sync_wait *sync = user;
+	struct davici_packet *pkt;
 
-	va_copy(copy, args);
-	len = vsnprintf(buf, sizeof(buf), fmt, copy);
-	va_end(copy);
-	if (len >= (int)sizeof(buf))
+	sync->done = 1;
+	sync->err = err;
+	if (err >= 0 && res)
 	{
-		m = malloc(len + 1);
-		if (m)
-		{
-			len = vsnprintf(m, len + 1, fmt, args);
-		}
-		else
+		sync->res = mem_calloc(sizeof(*res) + sizeof(*pkt) +
+						   res->pkt->received);
+		if (!sync->res)
 		{
-			len = -1;
+			sync->err = -errno;
+			return;
 		}
+		pkt = (struct davici_packet*)(sync->res + 1);
+		pkt->buf = (unsigned char*)(pkt + 1);
+		pkt->received = res->pkt->received;
+		memcpy(pkt->buf, res->pkt->buf, pkt->received);
+		sync->res->pkt = pkt;
 	}
-	if (len < 0)
-	{
-		r->err = -errno;
-	}
-	else
-	{
-		davici_list_item(r, m, len);
-	}
-	if (m != buf)
-	{
-		free(m);
-	}
-}
-
-void davici_list_end(struct davici_request *r)
-{
-	add_element(r, DAVICI_LIST_END, 0);
 }
 
-void davici_cancel(struct davici_request *r)
+static void discard_cb(struct davici_conn *c, int err, const char *name,
+					   struct davici_response *res, void *user)
 {
-	free(r->buf);
-	free(r);
 }
 
-static void append_req(struct davici_conn *c, struct davici_request *r)
+static int wait_sync(struct davici_conn *c, struct sync_wait *sync,
+					 int timeout)
 {
-	struct davici_request *cur;
+	struct pollfd pfd = {
+		.fd = c->s,
+	};
+	uint64_t deadline = 0, now;
+	int ret, err;
 
-	if (!c->reqs)
+	if (timeout >= 0)
 	{
-		c->reqs = r;
+		deadline = get_time_ns() + timeout * 1000000ULL;
 	}
-	else
+	/* try to send the request right away, the socket is usually writable */
+	err = davici_write(c);
+	while (err >= 0 && !sync->done)
 	{
-		cur = c->reqs;
-		while (cur->next)
+		pfd.events = 0;
+		if (c->wanted & DAVICI_READ)
+		{
+			pfd.events |= POLLIN;
+		}
+		if (c->wanted & DAVICI_WRITE)
+		{
+			pfd.events |= POLLOUT;
+		}
+		if (deadline)
+		{
+			now = get_time_ns();
+			if (now >= deadline)
+			{
+				return -ETIMEDOUT;
+			}
+			timeout = (deadline - now + 999999) / 1000000;
+		}
+		ret = poll(&pfd, 1, timeout);
+		if (ret == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -errno;
+		}
+		if (ret == 0)
+		{
+			return -ETIMEDOUT;
+		}
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+		{
+			err = davici_read(c);
+		}
+		if (err >= 0 && !sync->done && (pfd.revents & POLLOUT))
 		{
-			cur = cur->next;
+			err = davici_write(c);
 		}
-		cur->next = r;
 	}
+	return err;
 }
 
-int davici_queue(struct davici_conn *c, struct davici_request *r,
-				 davici_cb cmd_cb, void *user)
+int davici_call_sync(struct davici_conn *c, struct davici_request *r,
+					 int timeout, struct davici_response **resp)
 {
-	int err;
+	struct sync_wait sync = { 0 };
+	int err, ret;
 
-	if (r->err)
+	if (c->dispatching)
 	{
-		err = r->err;
 		davici_cancel(r);
+		return -EDEADLK;
+	}
+	davici_batch_begin(c);
+	err = davici_queue(c, r, sync_cb, &sync);
+	if (err >= 0)
+	{
+		err = wait_sync(c, &sync, timeout);
+		if (!sync.done)
+		{
+			/* request stays queued, but sync goes out of scope */
+			r->user = NULL;
+			r->cb = discard_cb;
+		}
+	}
+	ret = davici_batch_commit(c);
+	if (err >= 0 && sync.done)
+	{
+		err = sync.err;
+	}
+	if (err >= 0)
+	{
+		err = ret;
+	}
+	if (err < 0)
+	{
+		mem_free(sync.res);
 		return err;
 	}
-	r->cb = cmd_cb;
-	r->user = user;
+	*resp = sync.res;
+	return 0;
+}
 
-	append_req(c, r);
+void davici_free_response(struct davici_response *res)
+{
+	mem_free(res);
+}
 
-	return update_ops(c, c->ops | DAVICI_WRITE);
+unsigned int davici_queue_len(struct davici_conn *c)
+{
+	return c->unsent_count + c->inflight_count;
 }
 
-int davici_queue_streamed(struct davici_conn *c, struct davici_request *r,
-						  davici_cb cmd_cb, const char *event,
-						  davici_cb event_cb, void *user)
+unsigned int davici_queue_unsent(struct davici_conn *c)
 {
-	int err;
+	return c->unsent_count;
+}
 
-	if (r->err)
-	{
-		err = r->err;
-		davici_cancel(r);
-		return err;
-	}
-	err = davici_register(c, event, event_cb, user);
-	if (err)
-	{
-		return err;
-	}
-	err = davici_queue(c, r, cmd_cb, user);
-	davici_unregister(c, event, event_cb, user);
-	return err;
+unsigned int davici_queue_inflight(struct davici_conn *c)
+{
+	return c->inflight_count;
 }
 
-unsigned int davici_queue_len(struct davici_conn *c)
+int davici_set_window(struct davici_conn *c, unsigned int window)
 {
-	struct davici_request *req;
-	unsigned int count = 0;
+	c->window = window;
+	return update_write(c);
+}
 
-	req = c->reqs;
-	while (req)
+int davici_set_limit(struct davici_conn *c, enum davici_limit limit,
+					 unsigned int value)
+{
+	switch (limit)
 	{
-		req = req->next;
-		count++;
+		case DAVICI_LIMIT_MSG_SIZE:
+			c->max_msg = value;
+			return 0;
+		case DAVICI_LIMIT_SEND_QUEUE:
+			c->max_unsent = value;
+			return 0;
+		default:
+			return -EINVAL;
 	}
-	return count;
 }
 
 int davici_register(struct davici_conn *c, const char *event,
@@ -949,11 +3178,17 @@ int davici_register(struct davici_conn *c, const char *event,
 	{
 		return err;
 	}
+	err = check_unsent(c, req);
+	if (err)
+	{
+		davici_cancel(req);
+		return err;
+	}
 	req->cb = cb;
 	req->user = user;
 	append_req(c, req);
 
-	return update_ops(c, c->ops | DAVICI_WRITE);
+	return update_write(c);
 }
 
 int davici_unregister(struct davici_conn *c, const char *event,
@@ -967,11 +3202,17 @@ int davici_unregister(struct davici_conn *c, const char *event,
 	{
 		return err;
 	}
+	err = check_unsent(c, req);
+	if (err)
+	{
+		davici_cancel(req);
+		return err;
+	}
 	req->cb = cb;
 	req->user = user;
 	append_req(c, req);
 
-	return update_ops(c, c->ops | DAVICI_WRITE);
+	return update_write(c);
 }
 
 static int parse_name(struct davici_response *res)
@@ -1036,6 +3277,7 @@ int davici_parse(struct davici_response *res)
 	{
 		return -EINVAL;
 	}
+	res->elem = res->pos;
 	type = res->pkt->buf[res->pos++];
 	switch (type)
 	{
@@ -1109,6 +3351,127 @@ int davici_parse(struct davici_response *res)
 	}
 }
 
+int davici_splice(struct davici_request *r, struct davici_response *res,
+				  const char *name)
+{
+	unsigned int start, end, hdr, level;
+	unsigned char *pos, *orig;
+	int type, inner;
+	uint8_t nlen;
+
+	if (r->err)
+	{
+		return r->err;
+	}
+	if (res->elem >= res->pos)
+	{
+		return -EINVAL;
+	}
+	type = res->pkt->buf[res->elem];
+	if (type != DAVICI_SECTION_START && type != DAVICI_LIST_START)
+	{
+		return -EINVAL;
+	}
+	orig = res->pkt->buf + res->elem + 1;
+	start = res->pos;
+	level = res->section;
+	do
+	{
+		inner = davici_parse(res);
+		if (inner < 0)
+		{
+			return inner;
+		}
+	}
+	while (!(inner == DAVICI_LIST_END && type == DAVICI_LIST_START) &&
+		   !(inner == DAVICI_SECTION_END && res->section < level));
+	end = res->pos;
+
+	if (name)
+	{
+		nlen = strlen(name);
+	}
+	else
+	{
+		nlen = orig[0];
+		name = (const char*)orig + 1;
+	}
+	hdr = 1 + nlen;
+	pos = add_element(r, type, hdr + end - start);
+	if (pos)
+	{
+		pos[0] = nlen;
+		memcpy(pos + 1, name, nlen);
+		memcpy(pos + hdr, res->pkt->buf + start, end - start);
+	}
+	return r->err;
+}
+
+static int check_fragment(struct davici_request *frag)
+{
+	struct davici_packet pkt = {
+		.received = frag->used,
+		.buf = frag->buf,
+	};
+	struct davici_response res = {
+		.pkt = &pkt,
+	};
+	int type;
+
+	if (frag->err)
+	{
+		return frag->err;
+	}
+	if (!frag->fragment || frag->measure ||
+		frag->ref_count || frag->slot_count)
+	{
+		return -EINVAL;
+	}
+	if (frag->checked == frag->used)
+	{
+		return 0;
+	}
+	do
+	{
+		type = davici_parse(&res);
+		if (type < 0)
+		{
+			return type;
+		}
+	}
+	while (type != DAVICI_END);
+	frag->checked = frag->used;
+	return 0;
+}
+
+int davici_add_fragment(struct davici_request *r,
+						struct davici_request *frag)
+{
+	int err;
+
+	if (r->err)
+	{
+		return r->err;
+	}
+	err = check_fragment(frag);
+	if (err < 0)
+	{
+		return err;
+	}
+	if (!r->measure)
+	{
+		err = davici_reserve(r, frag->used);
+		if (err < 0)
+		{
+			r->err = err;
+			return err;
+		}
+		memcpy(r->buf + r->used, frag->buf, frag->used);
+	}
+	r->used += frag->used;
+	return 0;
+}
+
 int davici_recurse(struct davici_response *res, davici_recursecb section,
 				   davici_recursecb li, davici_recursecb kv, void *user)
 {
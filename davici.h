@@ -24,7 +24,11 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -40,6 +44,16 @@ struct davici_conn;
  */
 struct davici_request;
 
+/**
+ * Opaque immutable, reference counted request message.
+ */
+struct davici_message;
+
+/**
+ * Opaque memory mapped cache of shared messages.
+ */
+struct davici_cache;
+
 /**
  * Opaque response message context.
  */
@@ -75,6 +89,60 @@ enum davici_fdops {
 	DAVICI_WRITE = (1<<1),
 };
 
+/**
+ * Per-connection resource limits.
+ */
+enum davici_limit {
+	/** maximum size of a received message, in bytes */
+	DAVICI_LIMIT_MSG_SIZE,
+	/** maximum size of all queued, but unsent requests, in bytes */
+	DAVICI_LIMIT_SEND_QUEUE,
+};
+
+/**
+ * Memory allocator hooks used for all davici allocations.
+ *
+ * The hooks have malloc(), realloc() and free() semantics, but receive the
+ * user context of the allocator as an additional argument. The release hook
+ * never gets invoked with a NULL pointer.
+ */
+struct davici_allocator {
+	/** allocate size bytes of memory, NULL on failure */
+	void* (*alloc)(size_t size, void *user);
+	/** resize a memory block to size bytes, NULL on failure */
+	void* (*resize)(void *ptr, size_t size, void *user);
+	/** release a memory block */
+	void (*release)(void *ptr, void *user);
+	/** user context passed to hooks */
+	void *user;
+};
+
+/**
+ * Descriptor of a message element to encode with davici_add_table().
+ */
+struct davici_desc {
+	/** element type, any but DAVICI_END */
+	enum davici_element type;
+	/** name of section, list or key, if any */
+	const char *name;
+	/** length of name, at most 255 bytes */
+	unsigned int namelen;
+	/** value of key/value pair or list item, if any */
+	const void *value;
+	/** length of value, at most 65535 bytes */
+	unsigned int valuelen;
+};
+
+/**
+ * Value to patch into a request template slot.
+ */
+struct davici_slot {
+	/** value to patch into slot */
+	const void *buf;
+	/** length of value, at most 65535 bytes */
+	unsigned int len;
+};
+
 /**
  * Prototype for a command response or event callback function.
  *
@@ -137,6 +205,71 @@ typedef int (*davici_fdcb)(struct davici_conn *conn, int fd, int ops,
  */
 typedef int (*davici_recursecb)(struct davici_response *res, void *user);
 
+/**
+ * Prototype for an incremental response element callback.
+ *
+ * This callback is used by davici_queue_incremental() and gets invoked for
+ * each element of a response message as soon as it has been received. The
+ * passed response context may be used with davici_get_name(),
+ * davici_get_level(), davici_get_value() and associated functions to access
+ * the element, but not with davici_parse().
+ *
+ * If this callback returns a negative errno, no further elements are
+ * delivered, and the same errno is passed to the result callback.
+ *
+ * @param res		response message element context
+ * @param type		type of the received element
+ * @param user		user context, as passed to davici_queue_incremental()
+ * @return			a negative errno on error to stop delivering elements
+ */
+typedef int (*davici_elementcb)(struct davici_response *res,
+								enum davici_element type, void *user);
+
+/**
+ * Replace the memory allocator used by davici.
+ *
+ * The allocator is used for all connection, request and response memory
+ * of the core library, and gets copied by this call. The sync engine, the
+ * event loop and the io_uring driver keep allocating their own state from
+ * the C library. It is global to the library, so it must be
+ * set before any davici object gets created, and may be changed only once
+ * all objects have been released again.
+ *
+ * @param alloc		allocator hooks to use, NULL to use the C library
+ */
+void davici_set_allocator(const struct davici_allocator *alloc);
+
+/**
+ * Prototype for a callback releasing a value referenced by a request.
+ *
+ * @param buf		referenced value buffer
+ * @param len		length of referenced value
+ * @param user		user context passed along with the reference
+ */
+typedef void (*davici_releasecb)(const void *buf, unsigned int len,
+								 void *user);
+
+/**
+ * Prototype for a request body generator callback.
+ *
+ * The generator adds the elements of a request body in steps, using the
+ * usual functions to add elements to the passed request. It gets invoked
+ * with an increasing index, starting at 0, and returns 1 as long as more
+ * steps follow. The generator may add any number of elements in a step,
+ * but may not use referenced values or slots.
+ *
+ * As the encoded size of the request must be known before sending it, the
+ * generator runs twice: once to measure the request when queueing it, and
+ * once while sending it. Both runs must produce the same elements.
+ *
+ * @param req		request to add elements to
+ * @param index		step index, starting at 0 for each run
+ * @param user		user context passed to davici_queue_generated()
+ * @return			1 if more steps follow, 0 when done, or a negative errno
+ */
+typedef int (*davici_generatecb)(struct davici_request *req,
+								 unsigned int index, void *user);
+
 /**
  * Create a connection to a BSD socket already connected to VICI.
  *
@@ -206,6 +339,31 @@ int davici_connect_tcp(struct sockaddr *addr, davici_fdcb fdcb, void *user,
  */
 int davici_read(struct davici_conn *conn);
 
+/**
+ * Read and process pending connection data, limited by a budget.
+ *
+ * Like davici_read(), but returns after dispatching a maximum number of
+ * messages or after a maximum time has elapsed, even if more data is
+ * pending on the connection. This allows fair dispatching of multiple
+ * connections if a single connection receives a flood of event messages.
+ *
+ * If the call returns 1, more data is pending, and the call should be
+ * repeated after other connections have been processed. Edge-triggered
+ * users must reschedule the connection, as no further readiness
+ * notification may be raised for the pending data.
+ *
+ * At least one message is dispatched if data is pending, so the time limit
+ * may be exceeded by the duration of a single message callback.
+ *
+ * @param conn			opaque connection context
+ * @param max_messages	maximum number of messages to dispatch, 0 for no limit
+ * @param max_ns		maximum time to spend in ns, 0 for no limit
+ * @return				1 if more data is pending, 0 if not, or a negative
+ *						errno
+ */
+int davici_read_budget(struct davici_conn *conn, unsigned int max_messages,
+					   unsigned long long max_ns);
+
 /**
  * Write queued request data to the connection.
  *
@@ -220,6 +378,58 @@ int davici_read(struct davici_conn *conn);
  */
 int davici_write(struct davici_conn *conn);
 
+/**
+ * Get a buffer to receive connection data to, for custom I/O drivers.
+ *
+ * davici_read() uses plain recv() calls to receive connection data. Custom
+ * I/O drivers may instead receive data to the buffer returned by this call,
+ * and pass the received data to davici_recv_done() for processing. The buffer
+ * is valid until davici_recv_done() has been called.
+ *
+ * @param conn		opaque connection context
+ * @param buf		pointer receiving the buffer to receive data to
+ * @param len		pointer receiving the size of the buffer
+ * @return			0 on success, or a negative errno
+ */
+int davici_recv_buf(struct davici_conn *conn, void **buf, unsigned int *len);
+
+/**
+ * Process data received to a buffer returned by davici_recv_buf().
+ *
+ * Dispatches any response or event message completed with the received
+ * data, just as davici_read() does.
+ *
+ * @param conn		opaque connection context
+ * @param len		number of bytes received to the buffer
+ * @return			0 on success, or a negative errno
+ */
+int davici_recv_done(struct davici_conn *conn, unsigned int len);
+
+/**
+ * Get queued request data to send, for custom I/O drivers.
+ *
+ * davici_write() uses plain sendmsg() calls to send queued request data.
+ * Custom I/O drivers may instead send the data referenced by the returned
+ * iovecs, and report the number of bytes sent with davici_send_done(). The
+ * referenced data is valid until davici_send_done() has been called.
+ *
+ * @param conn		opaque connection context
+ * @param iov		iovec array to fill with request data
+ * @param count		number of elements in iov, at least 2
+ * @return			number of iovecs filled, 0 if nothing to send
+ */
+unsigned int davici_send_iov(struct davici_conn *conn, struct iovec *iov,
+							 unsigned int count);
+
+/**
+ * Report the number of bytes sent from iovecs of davici_send_iov().
+ *
+ * @param conn		opaque connection context
+ * @param len		number of bytes sent
+ * @return			0 on success, or a negative errno
+ */
+int davici_send_done(struct davici_conn *conn, unsigned int len);
+
 /**
  * Close an open VICI connection and free associated resources.
  *
@@ -250,6 +460,104 @@ void davici_disconnect(struct davici_conn *conn);
  */
 int davici_new_cmd(const char *cmd, struct davici_request **reqp);
 
+/**
+ * Allocate a new request command message with a size hint.
+ *
+ * Like davici_new_cmd(), but preallocates the request buffer to hold
+ * an encoded message of the given size, as returned by davici_request_len().
+ * Building a request not exceeding the hint requires no further allocation.
+ *
+ * @param cmd		command name
+ * @param size		expected size of the encoded request
+ * @param reqp		receives allocated request context
+ * @return			0 on success, or a negative errno
+ */
+int davici_new_cmd_sized(const char *cmd, unsigned int size,
+						 struct davici_request **reqp);
+
+/**
+ * Allocate a request to measure the encoded size of a planned message.
+ *
+ * The returned request accepts all calls to add elements, but does not
+ * encode them. It just measures the size of the message, which can be
+ * passed to davici_new_cmd_sized() after querying it with
+ * davici_request_len(). Such a request can't be queued, but must be freed
+ * using davici_cancel().
+ *
+ * @param cmd		command name
+ * @param reqp		receives allocated request context
+ * @return			0 on success, or a negative errno
+ */
+int davici_new_measure(const char *cmd, struct davici_request **reqp);
+
+/**
+ * Allocate a reusable message fragment.
+ *
+ * A fragment is built like a request, but has no command name. It can be
+ * appended to any number of requests using davici_add_fragment(), so blocks
+ * shared by many requests get encoded just once. Fragments can't be queued,
+ * but must be freed using davici_cancel().
+ *
+ * @param reqp		receives allocated fragment context
+ * @return			0 on success, or a negative errno
+ */
+int davici_new_fragment(struct davici_request **reqp);
+
+/**
+ * Get the size of an encoded request message.
+ *
+ * @param req		request context
+ * @return			encoded size of the request, in bytes
+ */
+unsigned int davici_request_len(struct davici_request *req);
+
+/**
+ * Compute a 64-bit FNV-1a hash over the encoding of a request message.
+ *
+ * The hash covers the command name and all elements, including referenced
+ * values. Requests with equal content always have equal hashes. Requests
+ * with different content are unlikely to have equal hashes, but as with any
+ * hash, a collision is possible.
+ *
+ * @param req		request context
+ * @param hash		receives the hash value
+ * @return			0 on success, -EINVAL for templates, measuring or
+ *					generated requests
+ */
+int davici_request_hash(struct davici_request *req, uint64_t *hash);
+
+/**
+ * Reserve request buffer space for additional elements.
+ *
+ * Grows the request buffer to hold at least size additional bytes of
+ * encoded elements without further allocations.
+ *
+ * @param req		request context
+ * @param size		number of bytes to reserve
+ * @return			0 on success, or a negative errno
+ */
+int davici_reserve(struct davici_request *req, unsigned int size);
+
+/**
+ * Allocate a new request command message recycled by a connection.
+ *
+ * Like davici_new_cmd(), but takes the request from a pool of completed
+ * requests kept by the connection, retaining their buffers. After the
+ * response callback returns, or if the request gets davici_cancel()ed,
+ * it is returned to the pool of that connection. This avoids any memory
+ * allocation for steady state command traffic.
+ *
+ * The request must be queued to the same connection, and must be queued or
+ * cancelled before that connection gets disconnected.
+ *
+ * @param conn		connection context to recycle request with
+ * @param cmd		command name
+ * @param reqp		receives allocated request context
+ * @return			0 on success, or a negative errno
+ */
+int davici_new_cmd_pooled(struct davici_conn *conn, const char *cmd,
+						  struct davici_request **reqp);
+
 /**
  * Begin a new section on a request message.
  *
@@ -316,6 +624,107 @@ void davici_kvf(struct davici_request *req, const char *name,
 void davici_vkvf(struct davici_request *req, const char *name,
 				 const char *fmt, va_list args);
 
+/**
+ * Add a key with a referenced value to the request message.
+ *
+ * Instead of copying the value to the request buffer as davici_kv() does,
+ * the request just references the value buffer, which must stay valid until
+ * the release callback gets invoked. The value gets transmitted directly
+ * from the referenced buffer. The release callback is invoked once the
+ * request has been sent and completed or cancelled, or immediately if
+ * adding the value fails.
+ *
+ * Requests with referenced values can't be used with davici_freeze() or
+ * as template.
+ *
+ * @param req		request context
+ * @param name		key name
+ * @param buf		value buffer to reference
+ * @param buflen	size, in bytes, of buf, at most 65535
+ * @param release	callback releasing buf, or NULL
+ * @param user		user context to pass to release callback
+ */
+void davici_kv_ref(struct davici_request *req, const char *name,
+				   const void *buf, unsigned int buflen,
+				   davici_releasecb release, void *user);
+
+/**
+ * Add a key with a value read from a file to the request message.
+ *
+ * The file range gets mapped to memory and referenced by the request as
+ * with davici_kv_ref(), so it is transmitted without reading it into an
+ * intermediate buffer. The file descriptor may be closed after this call,
+ * but the file range must not be truncated until the request completes.
+ * A range exceeding the size of the file fails the request with -EINVAL.
+ *
+ * @param req		request context
+ * @param name		key name
+ * @param fd		file descriptor of file opened for reading
+ * @param offset	offset of the value within the file
+ * @param len		length of the value, at most 65535
+ */
+void davici_kv_file(struct davici_request *req, const char *name,
+					int fd, off_t offset, unsigned int len);
+
+/**
+ * Add a key with an unsigned integer value to the request message.
+ *
+ * The value is encoded as decimal string, directly into the request buffer.
+ *
+ * @param req		request context
+ * @param name		key name
+ * @param value		value to encode
+ */
+void davici_kv_u64(struct davici_request *req, const char *name,
+				   uint64_t value);
+
+/**
+ * Add a key with a signed integer value to the request message.
+ *
+ * The value is encoded as decimal string, directly into the request buffer.
+ *
+ * @param req		request context
+ * @param name		key name
+ * @param value		value to encode
+ */
+void davici_kv_i64(struct davici_request *req, const char *name,
+				   int64_t value);
+
+/**
+ * Add a key with a boolean value to the request message.
+ *
+ * The value is encoded as "yes" or "no", as used by VICI.
+ *
+ * @param req		request context
+ * @param name		key name
+ * @param value		value to encode, non-zero for "yes"
+ */
+void davici_kv_bool(struct davici_request *req, const char *name, int value);
+
+/**
+ * Add a key with an IP address value to the request message.
+ *
+ * The address of an AF_INET or AF_INET6 socket address is encoded in its
+ * textual representation; the port is ignored.
+ *
+ * @param req		request context
+ * @param name		key name
+ * @param addr		socket address to encode the address of
+ */
+void davici_kv_inaddr(struct davici_request *req, const char *name,
+					  const struct sockaddr *addr);
+
+/**
+ * Add a key with a binary value encoded as hex string to the request message.
+ *
+ * @param req		request context
+ * @param name		key name
+ * @param buf		binary value to encode
+ * @param buflen	size, in bytes, of buf, at most 32767
+ */
+void davici_kv_hex(struct davici_request *req, const char *name,
+				   const void *buf, unsigned int buflen);
+
 /**
  * Begin a list of unnamed items in a request message.
  *
@@ -366,6 +775,73 @@ void davici_list_itemf(struct davici_request *req, const char *fmt, ...);
 void davici_list_vitemf(struct davici_request *req, const char *fmt,
 						va_list args);
 
+/**
+ * Add a list item with a referenced value, see davici_kv_ref().
+ *
+ * @param req		request context
+ * @param buf		value buffer to reference
+ * @param buflen	size, in bytes, of buf, at most 65535
+ * @param release	callback releasing buf, or NULL
+ * @param user		user context to pass to release callback
+ */
+void davici_list_item_ref(struct davici_request *req, const void *buf,
+						  unsigned int buflen, davici_releasecb release,
+						  void *user);
+
+/**
+ * Add a list item with a value read from a file, see davici_kv_file().
+ *
+ * @param req		request context
+ * @param fd		file descriptor of file opened for reading
+ * @param offset	offset of the value within the file
+ * @param len		length of the value, at most 65535
+ */
+void davici_list_item_file(struct davici_request *req, int fd, off_t offset,
+						   unsigned int len);
+
+/**
+ * Add a list item with an unsigned integer value, see davici_kv_u64().
+ *
+ * @param req		request context
+ * @param value		value to encode
+ */
+void davici_list_item_u64(struct davici_request *req, uint64_t value);
+
+/**
+ * Add a list item with a signed integer value, see davici_kv_i64().
+ *
+ * @param req		request context
+ * @param value		value to encode
+ */
+void davici_list_item_i64(struct davici_request *req, int64_t value);
+
+/**
+ * Add a list item with a boolean value, see davici_kv_bool().
+ *
+ * @param req		request context
+ * @param value		value to encode, non-zero for "yes"
+ */
+void davici_list_item_bool(struct davici_request *req, int value);
+
+/**
+ * Add a list item with an IP address value, see davici_kv_inaddr().
+ *
+ * @param req		request context
+ * @param addr		socket address to encode the address of
+ */
+void davici_list_item_inaddr(struct davici_request *req,
+							 const struct sockaddr *addr);
+
+/**
+ * Add a list item with a hex encoded binary value, see davici_kv_hex().
+ *
+ * @param req		request context
+ * @param buf		binary value to encode
+ * @param buflen	size, in bytes, of buf, at most 32767
+ */
+void davici_list_item_hex(struct davici_request *req, const void *buf,
+						  unsigned int buflen);
+
 /**
  * End a list previously opened for a request message.
  *
@@ -375,6 +851,101 @@ void davici_list_vitemf(struct davici_request *req, const char *fmt,
  */
 void davici_list_end(struct davici_request *req);
 
+/**
+ * Add a table of message elements to the request message.
+ *
+ * Encodes all elements described by the table with a single buffer
+ * reservation. Sections and lists get nested by their start and end elements
+ * as if the corresponding davici_section_start() and similar functions were
+ * called in table order, so a table may also contain just the content of a
+ * section or list opened by the caller. Descriptor tables for static parts
+ * of a message may be declared const and reused.
+ *
+ * @param req		request context
+ * @param descs		element descriptors to encode
+ * @param count		number of element descriptors
+ * @return			0 on success, -EINVAL if a descriptor is invalid
+ */
+int davici_add_table(struct davici_request *req,
+					 const struct davici_desc *descs, unsigned int count);
+
+/**
+ * Copy a section or list subtree from a parsed message to a request.
+ *
+ * Must be called directly after davici_parse() returned DAVICI_SECTION_START
+ * or DAVICI_LIST_START. The subtree gets validated by parsing it up to the
+ * matching end element, and its encoding is then copied to the request as
+ * is, without decoding and re-encoding the contained elements. On return,
+ * the parser is positioned after the subtree, as with davici_recurse().
+ *
+ * This allows re-submitting configuration received from one daemon to
+ * another. It can't be used for elements passed to a davici_elementcb, as
+ * their subtree is not buffered.
+ *
+ * @param req		request context
+ * @param res		response or event message to copy subtree from
+ * @param name		new name for the copied section or list, NULL to keep
+ * @return			0 on success, or a negative errno
+ */
+int davici_splice(struct davici_request *req, struct davici_response *res,
+				  const char *name);
+
+/**
+ * Append a fragment to a request message.
+ *
+ * The fragment gets copied to the current position of the request, which
+ * may be at any nesting level. The fragment must contain balanced sections
+ * and lists, which is verified when it is first added after a change. It
+ * may not contain referenced values or slots.
+ *
+ * @param req		request context to append fragment to
+ * @param frag		fragment created with davici_new_fragment()
+ * @return			0 on success, -EINVAL or -EBADMSG if fragment is invalid
+ */
+int davici_add_fragment(struct davici_request *req,
+						struct davici_request *frag);
+
+/**
+ * Add a key/value slot to a request template.
+ *
+ * Adds a key/value pair with a value to patch in by davici_instantiate().
+ * Any request containing slots is a template, which can't be queued
+ * directly, but must be freed using davici_cancel().
+ *
+ * @param req		request template context
+ * @param name		key name
+ */
+void davici_kv_slot(struct davici_request *req, const char *name);
+
+/**
+ * Add a list item slot to a request template.
+ *
+ * Adds a list item with a value to patch in by davici_instantiate(). The
+ * call is valid only between davici_list_start() and davici_list_end().
+ *
+ * @param req		request template context
+ */
+void davici_list_item_slot(struct davici_request *req);
+
+/**
+ * Create a request from a template by patching in slot values.
+ *
+ * The new request has the encoding of the template, but with the values
+ * passed for the slots in the order they have been added to the template.
+ * It is built with a single allocation of exactly the required size, and
+ * can be queued as any other request. The template is not modified and can
+ * be instantiated any number of times.
+ *
+ * @param tmpl		request template, containing slots
+ * @param values	values to patch into slots, one per slot
+ * @param count		number of values, must match the number of slots
+ * @param reqp		receives allocated request context
+ * @return			0 on success, or a negative errno
+ */
+int davici_instantiate(const struct davici_request *tmpl,
+					   const struct davici_slot *values, unsigned int count,
+					   struct davici_request **reqp);
+
 /**
  * Clean up a request if it is not passed to davici_queue().
  *
@@ -404,6 +975,168 @@ void davici_cancel(struct davici_request *req);
 int davici_queue(struct davici_conn *conn, struct davici_request *req,
 				 davici_cb cb, void *user);
 
+/**
+ * Convert a request message to an immutable shared message.
+ *
+ * The encoded request gets converted to a reference counted message, which
+ * can be queued to any number of connections using davici_queue_message()
+ * without copying it. The request gets consumed by this call, also on
+ * failure.
+ *
+ * @param req		request message to convert
+ * @param msgp		receives shared message with a single reference
+ * @return			0 on success, or a negative errno
+ */
+int davici_freeze(struct davici_request *req, struct davici_message **msgp);
+
+/**
+ * Get an additional reference to a shared message.
+ *
+ * @param msg		shared message
+ * @return			msg
+ */
+struct davici_message* davici_message_ref(struct davici_message *msg);
+
+/**
+ * Release a reference to a shared message.
+ *
+ * The message is freed when the last reference is released. References
+ * are counted atomically, so connections sharing a message may be
+ * operated by different threads.
+ *
+ * @param msg		shared message
+ */
+void davici_message_unref(struct davici_message *msg);
+
+/**
+ * Queue a shared message for submission as command request.
+ *
+ * Like davici_queue(), but queues a shared message created with
+ * davici_freeze(). The connection holds its own reference to the message
+ * while it is queued, and the caller keeps its reference.
+ *
+ * @param conn		connection context
+ * @param msg		shared message to queue
+ * @param cb		callback to invoke for response message
+ * @param user		user context to pass to callback
+ * @return			0 on success, or a negative errno
+ */
+int davici_queue_message(struct davici_conn *conn, struct davici_message *msg,
+						 davici_cb cb, void *user);
+
+/**
+ * Write shared messages to a cache file.
+ *
+ * The encoded messages get written to a temporary file, which then
+ * atomically replaces any existing file at path. The file carries a format
+ * version, the passed tag and a checksum over all messages. The tag allows
+ * the user to identify the configuration the messages were built from.
+ *
+ * @param path		path of the cache file to write
+ * @param tag		user defined tag stored in the cache
+ * @param msgs		shared messages created with davici_freeze()
+ * @param count		number of messages
+ * @return			0 on success, or a negative errno
+ */
+int davici_cache_write(const char *path, uint32_t tag,
+					   struct davici_message *const *msgs, unsigned int count);
+
+/**
+ * Open and map a cache file written with davici_cache_write().
+ *
+ * The file gets mapped to memory and verified, messages can then be queued
+ * directly from the mapping without encoding or copying them.
+ *
+ * @param path		path of the cache file to open
+ * @param tag		expected tag of the cache
+ * @param cachep	receives the cache context on success
+ * @return			0 on success, -EPROTO if the file has an unknown format,
+ *					-ESTALE if the tag does not match, -EBADMSG if the
+ *					file is corrupt, or a negative errno
+ */
+int davici_cache_open(const char *path, uint32_t tag,
+					  struct davici_cache **cachep);
+
+/**
+ * Get the number of messages in a cache.
+ *
+ * @param cache		cache context
+ * @return			number of messages
+ */
+unsigned int davici_cache_count(struct davici_cache *cache);
+
+/**
+ * Get a shared message from a cache.
+ *
+ * The returned message references the cache mapping, which stays valid
+ * until all messages got released using davici_message_unref(), even if
+ * the cache has been closed.
+ *
+ * @param cache		cache context
+ * @param index		index of the message, in the order written
+ * @param msgp		receives a shared message on success
+ * @return			0 on success, -ENOENT if index is invalid
+ */
+int davici_cache_get(struct davici_cache *cache, unsigned int index,
+					 struct davici_message **msgp);
+
+/**
+ * Close a cache opened with davici_cache_open().
+ *
+ * @param cache		cache context
+ */
+void davici_cache_close(struct davici_cache *cache);
+
+/**
+ * Queue a command request with a body produced by a generator.
+ *
+ * Instead of building the whole request in memory, the request body is
+ * produced on demand by a generator callback while the connection accepts
+ * data. Only a small window of the generated elements is buffered at a
+ * time, keeping memory usage flat for huge requests.
+ *
+ * The generator runs to completion once during this call to measure the
+ * request size, and then gets invoked again from davici_write(). If the
+ * generator fails or produces a different request while sending it, the
+ * connection can't continue, and davici_write() returns the error.
+ *
+ * @param conn		connection context
+ * @param cmd		command name
+ * @param gen		generator callback adding request elements
+ * @param cb		callback to invoke for response message
+ * @param user		user context to pass to generator and callback
+ * @return			0 on success, or a negative errno
+ */
+int davici_queue_generated(struct davici_conn *conn, const char *cmd,
+						   davici_generatecb gen, davici_cb cb, void *user);
+
+/**
+ * Queue a command request message with incremental response parsing.
+ *
+ * In contrast to davici_queue(), the response message is not buffered as a
+ * whole before it gets passed to the user. Instead, davici_read() invokes
+ * the element callback for each element of the response message as soon as
+ * it has been received, keeping only incomplete elements buffered. This
+ * limits the memory required to receive a huge response to the size of
+ * its largest element, and the limit set with DAVICI_LIMIT_MSG_SIZE does
+ * not apply.
+ *
+ * Once the response has been received completely, the result callback gets
+ * invoked with a NULL response. Its error is negative if the response is
+ * malformed, the element callback failed, or the command is unknown.
+ *
+ * @param conn		connection context
+ * @param req		request message to queue
+ * @param elementcb	callback to invoke for each response element
+ * @param cb		result callback to invoke after the response
+ * @param user		user context to pass to callbacks
+ * @return			0 on success, or a negative errno
+ */
+int davici_queue_incremental(struct davici_conn *conn,
+							 struct davici_request *req,
+							 davici_elementcb elementcb, davici_cb cb,
+							 void *user);
+
 /**
  * Queue a command request using event based streaming.
  *
@@ -423,14 +1156,159 @@ int davici_queue_streamed(struct davici_conn *conn, struct davici_request *req,
 						  davici_cb res_cb, const char *event,
 						  davici_cb event_cb, void *user);
 
+/**
+ * Issue a command request and synchronously wait for its response.
+ *
+ * This call queues a request like davici_queue(), but then drives the
+ * connection with poll() until the response has been received or the
+ * timeout expires. Any other queued request or registered event callback
+ * gets dispatched while waiting. The file descriptor watch callback is
+ * invoked at most once, to reflect the final watch state.
+ *
+ * The call may not be used from within davici callbacks, and not for
+ * connections driven by an I/O driver other than davici_read() and
+ * davici_write(), such as the io_uring driver.
+ *
+ * On success, the response message is returned and may be parsed with
+ * davici_parse() and associated functions. It must be freed using
+ * davici_free_response(). On timeout, the request stays queued, but its
+ * response gets discarded once it arrives.
+ *
+ * @param conn		connection context
+ * @param req		request message to issue
+ * @param timeout	timeout in ms, -1 to wait forever
+ * @param resp		pointer receiving the response message on success
+ * @return			0 on success, -ETIMEDOUT on timeout, -ENOSYS if the
+ *					command is unknown, or another negative errno
+ */
+int davici_call_sync(struct davici_conn *conn, struct davici_request *req,
+					 int timeout, struct davici_response **resp);
+
+/**
+ * Free a response message returned by davici_call_sync().
+ *
+ * @param res		response message to free
+ */
+void davici_free_response(struct davici_response *res);
+
+/**
+ * Begin a batch of queueing operations on a connection.
+ *
+ * While a batch is active, davici_queue(), davici_queue_streamed(),
+ * davici_register() and davici_unregister() just append requests to the
+ * connection queue, but do not invoke the file descriptor watch callback.
+ * The callback gets invoked at most once, when davici_batch_commit()
+ * completes the batch.
+ *
+ * Batches may be nested; the watch callback gets invoked when the outermost
+ * batch is committed.
+ *
+ * @param conn		connection context
+ */
+void davici_batch_begin(struct davici_conn *conn);
+
+/**
+ * Commit a batch of queueing operations started with davici_batch_begin().
+ *
+ * Updates the file descriptor watch for all operations queued during the
+ * batch, invoking the watch callback at most once.
+ *
+ * @param conn		connection context
+ * @return			0 on success, or a negative errno
+ */
+int davici_batch_commit(struct davici_conn *conn);
+
+/**
+ * Enable or disable deferred file descriptor watch updates.
+ *
+ * In deferred mode, davici records any change of the file descriptor watch
+ * state, but invokes the watch callback at most once at the end of
+ * davici_read(), davici_read_budget() and davici_write(), reflecting the
+ * final watch state only. Changes caused outside of these calls, such as
+ * by davici_queue() from the main loop, are applied with davici_flush_ops().
+ *
+ * Disabling the deferred mode flushes any pending watch update.
+ *
+ * @param conn		connection context
+ * @param deferred	1 to enable deferred mode, 0 to disable it
+ * @return			0 on success, or a negative errno
+ */
+int davici_set_deferred_ops(struct davici_conn *conn, int deferred);
+
+/**
+ * Invoke the file descriptor watch callback for pending watch updates.
+ *
+ * In deferred mode or after I/O drivers used davici_recv_done() or
+ * davici_send_done(), the user should call this function once per main loop
+ * iteration. The watch callback is invoked only if the watch state changed.
+ *
+ * @param conn		connection context
+ * @return			0 on success, or a negative errno
+ */
+int davici_flush_ops(struct davici_conn *conn);
+
 /**
  * Get the count of all queued davici request messages.
  *
+ * This includes both requests not yet sent and requests sent but waiting
+ * for a response.
+ *
  * @param conn		connection context
  * @return			number of request messages in queue
  */
 unsigned int davici_queue_len(struct davici_conn *conn);
 
+/**
+ * Get the count of queued request messages not yet completely sent.
+ *
+ * @param conn		connection context
+ * @return			number of unsent request messages in queue
+ */
+unsigned int davici_queue_unsent(struct davici_conn *conn);
+
+/**
+ * Get the count of request messages sent, but waiting for a response.
+ *
+ * @param conn		connection context
+ * @return			number of request messages in flight
+ */
+unsigned int davici_queue_inflight(struct davici_conn *conn);
+
+/**
+ * Limit the number of request messages in flight.
+ *
+ * By default, davici_write() sends all queued requests to the daemon as fast
+ * as the connection accepts them. With a window set, davici_write() holds
+ * back queued requests while the given number of requests is waiting for a
+ * response. A small window reduces the latency for requests queued later
+ * with higher priority, while a larger window increases throughput.
+ *
+ * Lowering the window does not affect requests already sent.
+ *
+ * @param conn		connection context
+ * @param window	maximum number of requests in flight, 0 for no limit
+ * @return			0 on success, or a negative errno
+ */
+int davici_set_window(struct davici_conn *conn, unsigned int window);
+
+/**
+ * Limit the memory a connection may use for buffering messages.
+ *
+ * By default, a connection accepts messages of any size the daemon sends,
+ * and queues any number of requests. With DAVICI_LIMIT_MSG_SIZE set,
+ * davici_read() fails with -EMSGSIZE before receiving a message exceeding
+ * the limit. With DAVICI_LIMIT_SEND_QUEUE set, davici_queue(),
+ * davici_register() and davici_unregister() fail with -ENOBUFS if the
+ * request would exceed the total size of queued, but not yet sent requests.
+ *
+ * @param conn		connection context
+ * @param limit		limit to set
+ * @param value		limit value in bytes, 0 for no limit
+ * @return			0 on success, -EINVAL if limit is unknown
+ */
+int davici_set_limit(struct davici_conn *conn, enum davici_limit limit,
+					 unsigned int value);
+
 /**
  * Register for event messages.
  *
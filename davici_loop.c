@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "davici_loop.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/* maximum number of events processed per epoll_wait() */
+#define LOOP_EVENTS_MAX 64
+
+struct davici_loop {
+	int efd;
+	unsigned int registered;
+	int stopped;
+	struct epoll_event events[LOOP_EVENTS_MAX];
+	int current;
+	int count;
+	davici_loop_errcb errcb;
+	void *user;
+};
+
+int davici_loop_create(davici_loop_errcb errcb, void *user,
+					   struct davici_loop **loopp)
+{
+	struct davici_loop *loop;
+	int err;
+
+	loop = calloc(1, sizeof(*loop));
+	if (!loop)
+	{
+		return -errno;
+	}
+	loop->efd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->efd == -1)
+	{
+		err = -errno;
+		free(loop);
+		return err;
+	}
+	loop->errcb = errcb;
+	loop->user = user;
+	*loopp = loop;
+	return 0;
+}
+
+static void forget_conn(struct davici_loop *loop, struct davici_conn *conn)
+{
+	int i;
+
+	/* drop events of the current batch for the unregistered connection */
+	for (i = loop->current; i < loop->count; i++)
+	{
+		if (loop->events[i].data.ptr == conn)
+		{
+			loop->events[i].data.ptr = NULL;
+		}
+	}
+}
+
+int davici_loop_fdcb(struct davici_conn *conn, int fd, int ops, void *user)
+{
+	struct davici_loop *loop = user;
+	struct epoll_event ev = {
+		.events = EPOLLET,
+		.data.ptr = conn,
+	};
+
+	if (!ops)
+	{
+		if (epoll_ctl(loop->efd, EPOLL_CTL_DEL, fd, NULL) == 0)
+		{
+			loop->registered--;
+		}
+		else if (errno != ENOENT)
+		{
+			return -errno;
+		}
+		forget_conn(loop, conn);
+		return 0;
+	}
+	if (ops & DAVICI_READ)
+	{
+		ev.events |= EPOLLIN;
+	}
+	if (ops & DAVICI_WRITE)
+	{
+		ev.events |= EPOLLOUT;
+	}
+	if (epoll_ctl(loop->efd, EPOLL_CTL_MOD, fd, &ev) == 0)
+	{
+		return 0;
+	}
+	if (errno != ENOENT)
+	{
+		return -errno;
+	}
+	if (epoll_ctl(loop->efd, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		return -errno;
+	}
+	loop->registered++;
+	return 0;
+}
+
+int davici_loop_get_fd(struct davici_loop *loop)
+{
+	return loop->efd;
+}
+
+static void dispatch(struct davici_loop *loop, struct davici_conn *conn,
+					 uint32_t events)
+{
+	int err = 0;
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+	{
+		err = davici_read(conn);
+	}
+	if (!err && (events & EPOLLOUT) && loop->events[loop->current].data.ptr)
+	{
+		err = davici_write(conn);
+	}
+	if (err < 0)
+	{
+		loop->errcb(conn, err, loop->user);
+	}
+}
+
+int davici_loop_run_once(struct davici_loop *loop, int timeout)
+{
+	struct davici_conn *conn;
+	int count;
+
+	count = epoll_wait(loop->efd, loop->events, LOOP_EVENTS_MAX, timeout);
+	if (count == -1)
+	{
+		if (errno == EINTR)
+		{
+			return 0;
+		}
+		return -errno;
+	}
+	loop->count = count;
+	for (loop->current = 0; loop->current < loop->count; loop->current++)
+	{
+		conn = loop->events[loop->current].data.ptr;
+		if (conn)
+		{
+			dispatch(loop, conn, loop->events[loop->current].events);
+		}
+	}
+	loop->count = 0;
+	return count;
+}
+
+int davici_loop_run(struct davici_loop *loop)
+{
+	int ret;
+
+	loop->stopped = 0;
+	while (!loop->stopped && loop->registered)
+	{
+		ret = davici_loop_run_once(loop, -1);
+		if (ret < 0)
+		{
+			return ret;
+		}
+	}
+	return 0;
+}
+
+void davici_loop_stop(struct davici_loop *loop)
+{
+	loop->stopped = 1;
+}
+
+void davici_loop_destroy(struct davici_loop *loop)
+{
+	close(loop->efd);
+	free(loop);
+}
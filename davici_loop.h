@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/**
+ * @defgroup davici_loop davici_loop
+ * @{
+ *
+ * Optional epoll based event loop for davici connections on Linux.
+ *
+ * The event loop owns an edge-triggered epoll instance and dispatches any
+ * number of davici connections. Connections get registered automatically
+ * if davici_loop_fdcb() is passed as file descriptor watch callback with
+ * the event loop as its user context when creating the connection.
+ *
+ * The event loop can run standalone using davici_loop_run(), or it may be
+ * nested into another main loop by watching the file descriptor returned by
+ * davici_loop_get_fd() for read-readiness, and calling davici_loop_run_once()
+ * with a zero timeout if it is readable.
+ */
+
+#ifndef _DAVICI_LOOP_H_
+#define _DAVICI_LOOP_H_
+
+#include <davici.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opaque event loop context.
+ */
+struct davici_loop;
+
+/**
+ * Prototype for a connection failure callback.
+ *
+ * The callback gets invoked by the event loop if davici_read() or
+ * davici_write() fails on a connection. The user usually should
+ * davici_disconnect() the connection, which is allowed from within the
+ * callback.
+ *
+ * @param conn		failed connection
+ * @param err		negative errno returned by davici_read()/davici_write()
+ * @param user		user context passed to davici_loop_create()
+ */
+typedef void (*davici_loop_errcb)(struct davici_conn *conn, int err,
+								  void *user);
+
+/**
+ * Create an epoll based event loop.
+ *
+ * @param errcb		callback invoked on connection failures
+ * @param user		user context to pass to errcb
+ * @param loopp		pointer receiving event loop context on success
+ * @return			0 on success, or a negative errno
+ */
+int davici_loop_create(davici_loop_errcb errcb, void *user,
+					   struct davici_loop **loopp);
+
+/**
+ * File descriptor watch callback registering connections with an event loop.
+ *
+ * Pass this function as davici_fdcb to the davici connect functions, with
+ * the event loop context as user context.
+ *
+ * @param conn		opaque connection context
+ * @param fd		connection file descriptor
+ * @param ops		watch operations, enum davici_fdops
+ * @param user		event loop context
+ * @return			0 on success, or a negative errno
+ */
+int davici_loop_fdcb(struct davici_conn *conn, int fd, int ops, void *user);
+
+/**
+ * Get the epoll file descriptor of the event loop for nesting.
+ *
+ * The returned file descriptor gets read-ready if any connection has
+ * pending I/O, upon which davici_loop_run_once() should be called.
+ *
+ * @param loop		event loop context
+ * @return			epoll file descriptor
+ */
+int davici_loop_get_fd(struct davici_loop *loop);
+
+/**
+ * Wait for and dispatch I/O on registered connections once.
+ *
+ * @param loop		event loop context
+ * @param timeout	time to wait for I/O in ms, 0 to not block, -1 forever
+ * @return			number of connections dispatched, or a negative errno
+ */
+int davici_loop_run_once(struct davici_loop *loop, int timeout);
+
+/**
+ * Dispatch I/O on registered connections until stopped.
+ *
+ * The call returns if davici_loop_stop() gets called, or if no connection
+ * is registered with the event loop anymore.
+ *
+ * @param loop		event loop context
+ * @return			0 on success, or a negative errno
+ */
+int davici_loop_run(struct davici_loop *loop);
+
+/**
+ * Stop a running davici_loop_run() call.
+ *
+ * This call is usually invoked from a davici callback.
+ *
+ * @param loop		event loop context
+ */
+void davici_loop_stop(struct davici_loop *loop);
+
+/**
+ * Destroy an event loop.
+ *
+ * Connections still registered with the event loop must not be used with
+ * it anymore, and should be disconnected before.
+ *
+ * @param loop		event loop context
+ */
+void davici_loop_destroy(struct davici_loop *loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DAVICI_LOOP_H_ */
+
+/**
+ * @}
+ */
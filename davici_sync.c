@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "davici_sync.h"
+
+#include <stdint.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* initial number of hash table buckets, a power of two */
+#define SYNC_TABLE_MIN 64
+
+struct sync_entry {
+	struct sync_entry *next;
+	struct davici_sync *sync;
+	enum davici_sync_type type;
+	uint64_t hash;
+	unsigned int round;
+	unsigned int pending;
+	int applied;
+	int failed;
+	int removed;
+	char name[];
+};
+
+struct davici_sync {
+	struct sync_entry **table;
+	unsigned int size;
+	unsigned int count;
+	unsigned int round;
+	davici_sync_cb cb;
+	void *user;
+};
+
+static const struct {
+	const char *cmd;
+	const char *key;
+} unloads[] = {
+	[DAVICI_SYNC_CONN] = { "unload-conn", "name" },
+	[DAVICI_SYNC_POOL] = { "unload-pool", "name" },
+	[DAVICI_SYNC_AUTHORITY] = { "unload-authority", "name" },
+	[DAVICI_SYNC_SHARED] = { "unload-shared", "id" },
+	[DAVICI_SYNC_KEY] = { "unload-key", "id" },
+};
+
+int davici_sync_create(davici_sync_cb cb, void *user,
+					   struct davici_sync **syncp)
+{
+	struct davici_sync *sync;
+
+	sync = calloc(1, sizeof(*sync));
+	if (!sync)
+	{
+		return -errno;
+	}
+	sync->size = SYNC_TABLE_MIN;
+	sync->table = calloc(sync->size, sizeof(sync->table[0]));
+	if (!sync->table)
+	{
+		free(sync);
+		return -errno;
+	}
+	sync->cb = cb;
+	sync->user = user;
+	*syncp = sync;
+	return 0;
+}
+
+static unsigned int hash_entry(enum davici_sync_type type, const char *name)
+{
+	unsigned int hash = 2166136261u ^ type;
+
+	while (*name)
+	{
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static struct sync_entry** find_entry(struct davici_sync *sync,
+									  enum davici_sync_type type,
+									  const char *name)
+{
+	struct sync_entry **entry;
+
+	entry = &sync->table[hash_entry(type, name) & (sync->size - 1)];
+	while (*entry)
+	{
+		if ((*entry)->type == type && strcmp((*entry)->name, name) == 0)
+		{
+			break;
+		}
+		entry = &(*entry)->next;
+	}
+	return entry;
+}
+
+static int grow_table(struct davici_sync *sync)
+{
+	struct sync_entry **table, *entry, *next;
+	unsigned int i, size, bucket;
+
+	size = sync->size * 2;
+	table = calloc(size, sizeof(table[0]));
+	if (!table)
+	{
+		return -errno;
+	}
+	for (i = 0; i < sync->size; i++)
+	{
+		for (entry = sync->table[i]; entry; entry = next)
+		{
+			next = entry->next;
+			bucket = hash_entry(entry->type, entry->name) & (size - 1);
+			entry->next = table[bucket];
+			table[bucket] = entry;
+		}
+	}
+	free(sync->table);
+	sync->table = table;
+	sync->size = size;
+	return 0;
+}
+
+static struct sync_entry* get_entry(struct davici_sync *sync,
+									enum davici_sync_type type,
+									const char *name)
+{
+	struct sync_entry **pos, *entry;
+
+	pos = find_entry(sync, type, name);
+	if (*pos)
+	{
+		return *pos;
+	}
+	if (sync->count >= sync->size)
+	{
+		if (grow_table(sync) < 0)
+		{
+			return NULL;
+		}
+		pos = find_entry(sync, type, name);
+	}
+	entry = calloc(1, sizeof(*entry) + strlen(name) + 1);
+	if (!entry)
+	{
+		return NULL;
+	}
+	entry->sync = sync;
+	entry->type = type;
+	strcpy(entry->name, name);
+	*pos = entry;
+	sync->count++;
+	return entry;
+}
+
+static void remove_entry(struct davici_sync *sync, struct sync_entry *entry)
+{
+	struct sync_entry **pos;
+
+	pos = find_entry(sync, entry->type, entry->name);
+	*pos = entry->next;
+	sync->count--;
+	free(entry);
+}
+
+static int check_success(struct davici_response *res)
+{
+	int type, success = 0;
+
+	while (1)
+	{
+		type = davici_parse(res);
+		switch (type)
+		{
+			case DAVICI_END:
+				return success ? 0 : -EIO;
+			case DAVICI_KEY_VALUE:
+				if (davici_get_level(res) == 0 &&
+					davici_name_strcmp(res, "success") == 0)
+				{
+					success = davici_value_strcmp(res, "yes") == 0;
+				}
+				break;
+			default:
+				if (type < 0)
+				{
+					return type;
+				}
+				break;
+		}
+	}
+}
+
+static void resultcb(struct davici_conn *conn, int err, const char *name,
+					 struct davici_response *res, void *user)
+{
+	struct sync_entry *entry = user;
+	struct davici_sync *sync = entry->sync;
+	int unload;
+
+	unload = strcmp(name, unloads[entry->type].cmd) == 0;
+	if (err >= 0)
+	{
+		err = check_success(res);
+		if (err < 0 && err != -EIO)
+		{
+			res = NULL;
+		}
+	}
+	if (err < 0)
+	{
+		entry->failed = 1;
+		if (unload)
+		{
+			/* the daemon still has the entry, unload it again on commit */
+			entry->removed = 0;
+		}
+	}
+	if (--entry->pending == 0)
+	{
+		entry->applied = !entry->failed && !entry->removed;
+		entry->failed = 0;
+	}
+	if (sync->cb)
+	{
+		sync->cb(conn, entry->type, entry->name, unload, err, res, sync->user);
+	}
+	if (entry->removed && !entry->pending)
+	{
+		remove_entry(sync, entry);
+	}
+}
+
+void davici_sync_begin(struct davici_sync *sync)
+{
+	sync->round++;
+}
+
+int davici_sync_load(struct davici_sync *sync, struct davici_conn *conn,
+					 enum davici_sync_type type, const char *name,
+					 struct davici_request *req)
+{
+	struct sync_entry *entry;
+	uint64_t hash;
+	int err;
+
+	if ((unsigned int)type >= sizeof(unloads) / sizeof(unloads[0]))
+	{
+		davici_cancel(req);
+		return -EINVAL;
+	}
+	err = davici_request_hash(req, &hash);
+	if (err < 0)
+	{
+		davici_cancel(req);
+		return err;
+	}
+	entry = get_entry(sync, type, name);
+	if (!entry)
+	{
+		err = -errno;
+		davici_cancel(req);
+		return err;
+	}
+	entry->round = sync->round;
+	entry->removed = 0;
+	if (entry->applied && entry->hash == hash)
+	{
+		davici_cancel(req);
+		return 0;
+	}
+	err = davici_queue(conn, req, resultcb, entry);
+	if (err < 0)
+	{
+		return err;
+	}
+	entry->hash = hash;
+	entry->applied = 0;
+	entry->pending++;
+	return 1;
+}
+
+static int unload_entry(struct davici_conn *conn, struct sync_entry *entry)
+{
+	struct davici_request *req;
+	int err;
+
+	err = davici_new_cmd(unloads[entry->type].cmd, &req);
+	if (err < 0)
+	{
+		return err;
+	}
+	davici_kv(req, unloads[entry->type].key, entry->name, strlen(entry->name));
+	err = davici_queue(conn, req, resultcb, entry);
+	if (err < 0)
+	{
+		return err;
+	}
+	entry->removed = 1;
+	entry->applied = 0;
+	entry->pending++;
+	return 0;
+}
+
+int davici_sync_commit(struct davici_sync *sync, struct davici_conn *conn)
+{
+	struct sync_entry *entry;
+	unsigned int i;
+	int err, count = 0;
+
+	for (i = 0; i < sync->size; i++)
+	{
+		for (entry = sync->table[i]; entry; entry = entry->next)
+		{
+			if (!entry->removed && entry->round != sync->round)
+			{
+				err = unload_entry(conn, entry);
+				if (err < 0)
+				{
+					return err;
+				}
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+void davici_sync_reset(struct davici_sync *sync)
+{
+	struct sync_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < sync->size; i++)
+	{
+		for (entry = sync->table[i]; entry; entry = entry->next)
+		{
+			entry->pending = 0;
+			entry->applied = 0;
+			entry->failed = 0;
+			entry->removed = 0;
+		}
+	}
+}
+
+void davici_sync_destroy(struct davici_sync *sync)
+{
+	struct sync_entry *entry, *next;
+	unsigned int i;
+
+	for (i = 0; i < sync->size; i++)
+	{
+		for (entry = sync->table[i]; entry; entry = next)
+		{
+			next = entry->next;
+			free(entry);
+		}
+	}
+	free(sync->table);
+	free(sync);
+}
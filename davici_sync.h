@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/**
+ * @defgroup davici_sync davici_sync
+ * @{
+ *
+ * Incremental configuration synchronization for davici connections.
+ *
+ * The sync engine tracks a content hash for each named configuration entry
+ * loaded to the daemon, such as connections, pools, authorities or shared
+ * secrets. To reload a configuration, the user starts a new round with
+ * davici_sync_begin(), passes the load request for each configuration entry
+ * to davici_sync_load(), and finishes the round with davici_sync_commit().
+ * Only requests for changed or new entries get queued, and entries not
+ * loaded during a round get unloaded.
+ *
+ * An entry is considered applied once the daemon confirmed its load request
+ * with a successful response. Failed entries get loaded again in the next
+ * round, even if unchanged.
+ */
+
+#ifndef _DAVICI_SYNC_H_
+#define _DAVICI_SYNC_H_
+
+#include <davici.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opaque sync engine context.
+ */
+struct davici_sync;
+
+/**
+ * Type of a synchronized configuration entry.
+ */
+enum davici_sync_type {
+	/** connection, loaded with load-conn, unloaded by name */
+	DAVICI_SYNC_CONN = 0,
+	/** virtual IP pool, loaded with load-pool, unloaded by name */
+	DAVICI_SYNC_POOL,
+	/** certification authority, loaded with load-authority */
+	DAVICI_SYNC_AUTHORITY,
+	/** shared secret, loaded with load-shared, unloaded by id */
+	DAVICI_SYNC_SHARED,
+	/** private key, loaded with load-key, unloaded by key identifier */
+	DAVICI_SYNC_KEY,
+};
+
+/**
+ * Prototype for a sync result callback.
+ *
+ * The callback gets invoked for each response to a load or unload request
+ * queued by the sync engine.
+ *
+ * @param conn		connection the request was queued to
+ * @param type		type of the configuration entry
+ * @param name		name of the configuration entry
+ * @param unload	1 for an unload response, 0 for a load response
+ * @param err		negative errno, -EIO if the daemon reports failure
+ * @param res		response message, NULL if none received or invalid
+ * @param user		user context passed to davici_sync_create()
+ */
+typedef void (*davici_sync_cb)(struct davici_conn *conn,
+							   enum davici_sync_type type, const char *name,
+							   int unload, int err,
+							   struct davici_response *res, void *user);
+
+/**
+ * Create a sync engine.
+ *
+ * @param cb		callback invoked for responses, or NULL
+ * @param user		user context to pass to callback
+ * @param syncp		receives the sync engine context on success
+ * @return			0 on success, or a negative errno
+ */
+int davici_sync_create(davici_sync_cb cb, void *user,
+					   struct davici_sync **syncp);
+
+/**
+ * Start a new synchronization round.
+ *
+ * @param sync		sync engine context
+ */
+void davici_sync_begin(struct davici_sync *sync);
+
+/**
+ * Load a configuration entry if it has changed.
+ *
+ * Compares the content hash of the load request against the state of the
+ * entry with the same type and name. If the entry has been applied with
+ * the same content before, the request gets freed. Otherwise it gets queued
+ * to the connection. In any case, the entry is marked as seen during the
+ * current round.
+ *
+ * @param sync		sync engine context
+ * @param conn		connection to queue request to
+ * @param type		type of the configuration entry
+ * @param name		name of the configuration entry to unload it by
+ * @param req		load request for the entry, gets consumed
+ * @return			1 if queued, 0 if unchanged, or a negative errno
+ */
+int davici_sync_load(struct davici_sync *sync, struct davici_conn *conn,
+					 enum davici_sync_type type, const char *name,
+					 struct davici_request *req);
+
+/**
+ * Finish a synchronization round by unloading removed entries.
+ *
+ * Queues an unload request for each entry not loaded during the current
+ * round. Entries the daemon failed to unload are kept, and get unloaded
+ * again by the next commit.
+ *
+ * @param sync		sync engine context
+ * @param conn		connection to queue unload requests to
+ * @return			number of queued unload requests, or a negative errno
+ */
+int davici_sync_commit(struct davici_sync *sync, struct davici_conn *conn);
+
+/**
+ * Forget the applied state of all entries.
+ *
+ * This should be called if the daemon has been restarted, so the next round
+ * loads all entries again. It must be called after reconnecting, as
+ * davici_disconnect() drops queued load and unload requests without invoking
+ * their callbacks. Entries dropped during the last rounds are kept, and
+ * get unloaded again by the next commit.
+ *
+ * Requests queued by the sync engine must be completed before, or their
+ * connections must have been disconnected.
+ *
+ * @param sync		sync engine context
+ */
+void davici_sync_reset(struct davici_sync *sync);
+
+/**
+ * Destroy a sync engine.
+ *
+ * Requests queued by the sync engine must be completed before, or their
+ * connections must have been disconnected.
+ *
+ * @param sync		sync engine context
+ */
+void davici_sync_destroy(struct davici_sync *sync);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DAVICI_SYNC_H_ */
+
+/**
+ * @}
+ */
@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "davici_uring.h"
+
+#include <stdint.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* maximum number of iovecs passed to a single send operation */
+#define SEND_IOV_MAX 64
+
+enum uring_op {
+	OP_RECV = 0,
+	OP_SEND = 1,
+	OP_POLL = 2,
+	OP_CANCEL = 3,
+};
+
+/* mask to extract enum uring_op from completion user data */
+#define OP_MASK 3
+
+struct uring_conn {
+	struct uring_conn *ready_next;
+	struct davici_conn *conn;
+	int fd;
+	int ops;
+	unsigned int pending;
+	unsigned int ready;
+	int busy;
+	int released;
+	int res[OP_CANCEL];
+	struct iovec iov[SEND_IOV_MAX];
+	struct msghdr msg;
+};
+
+struct davici_uring {
+	int fd;
+	unsigned int to_submit;
+	unsigned int sq_entries;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	struct uring_conn **conns;
+	unsigned int conns_size;
+	struct uring_conn *ready;
+	davici_uring_errcb errcb;
+	void *user;
+};
+
+static int enter(struct davici_uring *r, unsigned int min, int timeout)
+{
+	struct io_uring_getevents_arg arg = { 0 };
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	size_t argsz = 0;
+	void *argp = NULL;
+	int ret;
+
+	if (min)
+	{
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeout >= 0)
+		{
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000LL;
+			arg.ts = (uintptr_t)&ts;
+			flags |= IORING_ENTER_EXT_ARG;
+			argp = &arg;
+			argsz = sizeof(arg);
+		}
+	}
+	else if (!r->to_submit)
+	{
+		return 0;
+	}
+	ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, min, flags,
+				  argp, argsz);
+	if (ret < 0)
+	{
+		return -errno;
+	}
+	r->to_submit -= ret;
+	return 0;
+}
+
+static struct io_uring_sqe* get_sqe(struct davici_uring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, head;
+
+	tail = *r->sq_tail;
+	head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head >= r->sq_entries)
+	{
+		if (enter(r, 0, -1) < 0)
+		{
+			return NULL;
+		}
+		head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+		if (tail - head >= r->sq_entries)
+		{
+			return NULL;
+		}
+	}
+	sqe = &r->sqes[tail & *r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+	return sqe;
+}
+
+static void push_sqe(struct davici_uring *r)
+{
+	__atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+	r->to_submit++;
+}
+
+static int submit(struct davici_uring *r, struct uring_conn *uc,
+				  enum uring_op op)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t events = POLLOUT;
+	unsigned int len;
+	void *buf;
+	int err;
+
+	sqe = get_sqe(r);
+	if (!sqe)
+	{
+		return -EBUSY;
+	}
+	sqe->fd = uc->fd;
+	sqe->user_data = (uintptr_t)uc | op;
+	switch (op)
+	{
+		case OP_RECV:
+			err = davici_recv_buf(uc->conn, &buf, &len);
+			if (err < 0)
+			{
+				return err;
+			}
+			sqe->opcode = IORING_OP_RECV;
+			sqe->addr = (uintptr_t)buf;
+			sqe->len = len;
+			break;
+		case OP_SEND:
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->addr = (uintptr_t)&uc->msg;
+			sqe->len = 1;
+			break;
+		case OP_POLL:
+#if __BYTE_ORDER == __BIG_ENDIAN
+			events = (events << 16) | (events >> 16);
+#endif
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->poll32_events = events;
+			break;
+		default:
+			return -EINVAL;
+	}
+	push_sqe(r);
+	uc->pending |= (1 << op);
+	return 0;
+}
+
+static int kick(struct davici_uring *r, struct uring_conn *uc)
+{
+	unsigned int count;
+	int err;
+
+	if ((uc->ops & DAVICI_READ) && !(uc->pending & (1 << OP_RECV)))
+	{
+		err = submit(r, uc, OP_RECV);
+		if (err < 0)
+		{
+			return err;
+		}
+	}
+	if ((uc->ops & DAVICI_WRITE) &&
+		!(uc->pending & ((1 << OP_SEND) | (1 << OP_POLL))))
+	{
+		count = davici_send_iov(uc->conn, uc->iov, SEND_IOV_MAX);
+		if (count)
+		{
+			uc->msg.msg_iov = uc->iov;
+			uc->msg.msg_iovlen = count;
+			return submit(r, uc, OP_SEND);
+		}
+		/* nothing to send yet, but wait for async connect() */
+		return submit(r, uc, OP_POLL);
+	}
+	return 0;
+}
+
+static void reap(struct davici_uring *r)
+{
+	struct io_uring_cqe *cqe;
+	struct uring_conn *uc;
+	unsigned int head, tail;
+	enum uring_op op;
+
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail)
+	{
+		cqe = &r->cqes[head & *r->cq_mask];
+		op = cqe->user_data & OP_MASK;
+		uc = (struct uring_conn*)(uintptr_t)(cqe->user_data & ~OP_MASK);
+		if (op != OP_CANCEL)
+		{
+			uc->res[op] = cqe->res;
+			if (!uc->ready)
+			{
+				uc->ready_next = r->ready;
+				r->ready = uc;
+			}
+			uc->ready |= (1 << op);
+		}
+		head++;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void free_conn(struct davici_uring *r, struct uring_conn *uc)
+{
+	struct uring_conn **cur;
+
+	for (cur = &r->ready; *cur; cur = &(*cur)->ready_next)
+	{
+		if (*cur == uc)
+		{
+			*cur = uc->ready_next;
+			break;
+		}
+	}
+	if (r->conns[uc->fd] == uc)
+	{
+		r->conns[uc->fd] = NULL;
+	}
+	free(uc);
+}
+
+static int release_conn(struct davici_uring *r, struct uring_conn *uc)
+{
+	struct io_uring_sqe *sqe;
+	enum uring_op op;
+	int err;
+
+	uc->ops = 0;
+	for (op = OP_RECV; op < OP_CANCEL; op++)
+	{
+		if ((uc->pending & ~uc->ready) & (1 << op))
+		{
+			sqe = get_sqe(r);
+			if (!sqe)
+			{
+				return -EBUSY;
+			}
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = (uintptr_t)uc | op;
+			sqe->user_data = (uintptr_t)uc | OP_CANCEL;
+			push_sqe(r);
+		}
+	}
+	/* buffers are owned by the connection, wait until the kernel is done */
+	while (uc->pending & ~uc->ready)
+	{
+		err = enter(r, 1, -1);
+		if (err < 0 && err != -EINTR)
+		{
+			return err;
+		}
+		reap(r);
+	}
+	uc->pending = 0;
+	if (uc->busy)
+	{
+		uc->released = 1;
+	}
+	else
+	{
+		free_conn(r, uc);
+	}
+	return 0;
+}
+
+static int complete_op(struct uring_conn *uc, enum uring_op op)
+{
+	int res = uc->res[op];
+
+	if (res == -EINTR || res == -EAGAIN)
+	{
+		return 0;
+	}
+	switch (op)
+	{
+		case OP_RECV:
+			if (res == 0)
+			{
+				return -ECONNRESET;
+			}
+			if (res < 0)
+			{
+				return res;
+			}
+			return davici_recv_done(uc->conn, res);
+		case OP_SEND:
+			if (res < 0)
+			{
+				return res;
+			}
+			return davici_send_done(uc->conn, res);
+		case OP_POLL:
+			if (res < 0)
+			{
+				return res;
+			}
+			return davici_write(uc->conn);
+		default:
+			return -EINVAL;
+	}
+}
+
+static void process(struct davici_uring *r, struct uring_conn *uc,
+					unsigned int ready)
+{
+	static const enum uring_op order[] = { OP_SEND, OP_POLL, OP_RECV };
+	struct davici_conn *conn = uc->conn;
+	enum uring_op op;
+	unsigned int i;
+	int err = 0, ret;
+
+	uc->busy = 1;
+	/* complete sends first, as a response to a request sent may arrive
+	 * in the same batch of completions */
+	for (i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+	{
+		op = order[i];
+		if (ready & (1 << op))
+		{
+			ret = complete_op(uc, op);
+			uc->pending &= ~(1 << op);
+			if (!err)
+			{
+				err = ret;
+			}
+		}
+	}
+	if (!err && !uc->released)
+	{
+		err = kick(r, uc);
+	}
+	if (err && !uc->released)
+	{
+		r->errcb(conn, err, r->user);
+	}
+	uc->busy = 0;
+	if (uc->released)
+	{
+		free_conn(r, uc);
+	}
+}
+
+int davici_uring_fdcb(struct davici_conn *conn, int fd, int ops, void *user)
+{
+	struct davici_uring *r = user;
+	struct uring_conn *uc = NULL, **conns;
+	unsigned int size;
+
+	if (fd < 0)
+	{
+		return -EBADF;
+	}
+	if ((unsigned int)fd < r->conns_size)
+	{
+		uc = r->conns[fd];
+	}
+	if (!ops)
+	{
+		if (uc)
+		{
+			return release_conn(r, uc);
+		}
+		return 0;
+	}
+	if (!uc)
+	{
+		if ((unsigned int)fd >= r->conns_size)
+		{
+			size = r->conns_size ? r->conns_size : 16;
+			while (size <= (unsigned int)fd)
+			{
+				size *= 2;
+			}
+			conns = realloc(r->conns, size * sizeof(*conns));
+			if (!conns)
+			{
+				return -errno;
+			}
+			memset(conns + r->conns_size, 0,
+				   (size - r->conns_size) * sizeof(*conns));
+			r->conns = conns;
+			r->conns_size = size;
+		}
+		uc = calloc(1, sizeof(*uc));
+		if (!uc)
+		{
+			return -errno;
+		}
+		uc->fd = fd;
+		r->conns[fd] = uc;
+	}
+	uc->conn = conn;
+	uc->ops = ops;
+	uc->released = 0;
+	return kick(r, uc);
+}
+
+int davici_uring_run(struct davici_uring *r, int timeout)
+{
+	struct uring_conn *uc;
+	unsigned int ready;
+	int err, count = 0;
+
+	err = enter(r, r->ready ? 0 : 1, timeout);
+	if (err < 0 && err != -ETIME && err != -EINTR)
+	{
+		return err;
+	}
+	reap(r);
+	while (r->ready)
+	{
+		uc = r->ready;
+		r->ready = uc->ready_next;
+		ready = uc->ready;
+		uc->ready = 0;
+		process(r, uc, ready);
+		count++;
+	}
+	return count;
+}
+
+int davici_uring_create(unsigned int entries, davici_uring_errcb errcb,
+						void *user, struct davici_uring **ringp)
+{
+	struct io_uring_params p = { 0 };
+	struct davici_uring *r;
+	int err;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+	{
+		return -errno;
+	}
+	r->errcb = errcb;
+	r->user = user;
+	r->sq_ring = r->cq_ring = r->sqes = MAP_FAILED;
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+	{
+		err = -errno;
+		free(r);
+		return err;
+	}
+	if (!(p.features & IORING_FEAT_EXT_ARG))
+	{
+		davici_uring_destroy(r);
+		return -ENOTSUP;
+	}
+	r->sq_entries = p.sq_entries;
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(*r->cqes);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (r->cq_ring_size > r->sq_ring_size)
+		{
+			r->sq_ring_size = r->cq_ring_size;
+		}
+		r->cq_ring_size = 0;
+	}
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+	{
+		err = -errno;
+		davici_uring_destroy(r);
+		return err;
+	}
+	if (r->cq_ring_size)
+	{
+		r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+						  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED)
+		{
+			err = -errno;
+			davici_uring_destroy(r);
+			return err;
+		}
+	}
+	r->sqes_size = p.sq_entries * sizeof(*r->sqes);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+	{
+		err = -errno;
+		davici_uring_destroy(r);
+		return err;
+	}
+
+	r->sq_head = (void*)((char*)r->sq_ring + p.sq_off.head);
+	r->sq_tail = (void*)((char*)r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (void*)((char*)r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (void*)((char*)r->sq_ring + p.sq_off.array);
+	if (r->cq_ring == MAP_FAILED)
+	{
+		r->cq_head = (void*)((char*)r->sq_ring + p.cq_off.head);
+		r->cq_tail = (void*)((char*)r->sq_ring + p.cq_off.tail);
+		r->cq_mask = (void*)((char*)r->sq_ring + p.cq_off.ring_mask);
+		r->cqes = (void*)((char*)r->sq_ring + p.cq_off.cqes);
+	}
+	else
+	{
+		r->cq_head = (void*)((char*)r->cq_ring + p.cq_off.head);
+		r->cq_tail = (void*)((char*)r->cq_ring + p.cq_off.tail);
+		r->cq_mask = (void*)((char*)r->cq_ring + p.cq_off.ring_mask);
+		r->cqes = (void*)((char*)r->cq_ring + p.cq_off.cqes);
+	}
+
+	*ringp = r;
+	return 0;
+}
+
+void davici_uring_destroy(struct davici_uring *r)
+{
+	if (r->sqes != MAP_FAILED)
+	{
+		munmap(r->sqes, r->sqes_size);
+	}
+	if (r->cq_ring != MAP_FAILED)
+	{
+		munmap(r->cq_ring, r->cq_ring_size);
+	}
+	if (r->sq_ring != MAP_FAILED)
+	{
+		munmap(r->sq_ring, r->sq_ring_size);
+	}
+	close(r->fd);
+	free(r->conns);
+	free(r);
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/**
+ * @defgroup davici_uring davici_uring
+ * @{
+ *
+ * Optional io_uring based I/O driver for davici connections on Linux.
+ *
+ * Instead of watching file descriptors for readiness and calling
+ * davici_read()/davici_write(), the io_uring driver submits receive and send
+ * operations for any number of connections to a single io_uring instance,
+ * and processes their completions in batches.
+ *
+ * To use the driver, pass davici_uring_fdcb() as file descriptor watch
+ * callback and the io_uring driver context as its user context when creating
+ * a connection, and call davici_uring_run() to drive all connections.
+ *
+ * Disconnecting a connection is supported from the failure callback, but
+ * not from within davici callbacks invoked for messages received on that
+ * connection. Receive and send buffers are owned by the connection, so
+ * davici_disconnect() cancels outstanding operations and waits for the
+ * kernel to release them, which can't complete while the receive operation
+ * is being processed. Such a disconnect should be deferred until
+ * davici_uring_run() returns.
+ */
+
+#ifndef _DAVICI_URING_H_
+#define _DAVICI_URING_H_
+
+#include <davici.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opaque io_uring driver context.
+ */
+struct davici_uring;
+
+/**
+ * Prototype for a connection failure callback.
+ *
+ * The callback gets invoked by davici_uring_run() if an I/O operation on a
+ * connection fails. The user usually should davici_disconnect() the
+ * connection, which is allowed from within the callback.
+ *
+ * @param conn		failed connection
+ * @param err		negative errno of the failure
+ * @param user		user context passed to davici_uring_create()
+ */
+typedef void (*davici_uring_errcb)(struct davici_conn *conn, int err,
+								   void *user);
+
+/**
+ * Create an io_uring driver context.
+ *
+ * @param entries	number of submission queue entries
+ * @param errcb		callback invoked on connection failures
+ * @param user		user context to pass to errcb
+ * @param ringp		pointer receiving driver context on success
+ * @return			0 on success, or a negative errno
+ */
+int davici_uring_create(unsigned int entries, davici_uring_errcb errcb,
+						void *user, struct davici_uring **ringp);
+
+/**
+ * File descriptor watch callback driving connections with io_uring.
+ *
+ * Pass this function as davici_fdcb to the davici connect functions, with
+ * the io_uring driver context as user context.
+ *
+ * @param conn		opaque connection context
+ * @param fd		connection file descriptor
+ * @param ops		watch operations, enum davici_fdops
+ * @param user		io_uring driver context
+ * @return			0 on success, or a negative errno
+ */
+int davici_uring_fdcb(struct davici_conn *conn, int fd, int ops, void *user);
+
+/**
+ * Submit pending operations and process completions.
+ *
+ * Submits all pending receive and send operations with a single system call,
+ * waits for at least one completion, and processes all completions
+ * available.
+ *
+ * @param ring		io_uring driver context
+ * @param timeout	time to wait for completions in ms, -1 to wait forever
+ * @return			number of completions processed, or a negative errno
+ */
+int davici_uring_run(struct davici_uring *ring, int timeout);
+
+/**
+ * Destroy an io_uring driver context.
+ *
+ * All connections driven by the context must be disconnected before.
+ *
+ * @param ring		io_uring driver context
+ */
+void davici_uring_destroy(struct davici_uring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DAVICI_URING_H_ */
+
+/**
+ * @}
+ */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[64];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "echoreq");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_value_strcmp(res, "value") == 0);
+	assert(davici_parse(res) == DAVICI_END);
+	tester_complete(t);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tester_allocs counter = { 0 };
+	struct tester *t;
+	struct davici_conn *c;
+	struct davici_request *r;
+
+	tester_count_allocs(&counter);
+
+	counter.fail = 1;
+	assert(davici_new_cmd("echoreq", &r) == -ENOMEM);
+	counter.fail = 0;
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+	assert(davici_new_cmd("echoreq", &r) >= 0);
+	davici_kv(r, "key", "value", strlen("value"));
+	assert(davici_queue(c, r, reqcb, t) >= 0);
+	tester_runio(t, c);
+	davici_disconnect(c);
+	tester_cleanup(t);
+
+	assert(counter.allocs > 0);
+	assert(counter.allocs == counter.releases);
+	tester_count_allocs(NULL);
+	return 0;
+}
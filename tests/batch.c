@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static const unsigned int request_count = 64;
+static unsigned int fdcbs = 0;
+static unsigned int seen = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	static unsigned int state = 0;
+	char buf[64];
+	uint32_t len;
+
+	if (state++ == 0)
+	{
+		tester_read_eventreg(fd, "anevent");
+		tester_write_eventconfirm(fd);
+		return;
+	}
+	len = tester_read_cmdreq(fd, "echoreq");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static int countcb(struct davici_conn *c, int fd, int ops, void *user)
+{
+	fdcbs++;
+	return tester_davici_iocb(c, fd, ops, user);
+}
+
+static void eventcb(struct davici_conn *c, int err, const char *name,
+					struct davici_response *res, void *user)
+{
+	assert(err >= 0);
+	assert(strcmp(name, "anevent") == 0);
+	assert(res == NULL);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_value_strcmp(res, "value") == 0);
+	assert(davici_parse(res) == DAVICI_END);
+	if (++seen == request_count)
+	{
+		tester_complete(t);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct tester *t;
+	struct davici_conn *c;
+	struct davici_request *r;
+	unsigned int i;
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), countcb, t, &c) >= 0);
+
+	davici_batch_begin(c);
+	assert(davici_register(c, "anevent", eventcb, t) >= 0);
+	davici_batch_begin(c);
+	for (i = 0; i < request_count; i++)
+	{
+		assert(davici_new_cmd("echoreq", &r) >= 0);
+		davici_kv(r, "key", "value", strlen("value"));
+		assert(davici_queue(c, r, reqcb, t) >= 0);
+	}
+	assert(davici_batch_commit(c) >= 0);
+	assert(fdcbs == 0);
+	assert(davici_batch_commit(c) >= 0);
+	assert(fdcbs == 1);
+	assert(davici_queue_len(c) == request_count + 1);
+
+	tester_runio(t, c);
+	assert(seen == request_count);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+
+static const unsigned int event_count = 100;
+static unsigned int seen = 0;
+
+static void floodcb(struct tester *t, int fd)
+{
+	tester_read_eventreg(fd, "log");
+	tester_write_eventconfirm(fd);
+	tester_write_events(fd, "log", event_count);
+}
+
+static void logcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	assert(err >= 0);
+	if (res)
+	{
+		assert(davici_parse(res) == DAVICI_END);
+		seen++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct tester *t;
+	struct davici_conn *c;
+	unsigned int last;
+	int ret;
+
+	t = tester_create(floodcb);
+	assert(davici_connect_unix(tester_getpath(t),
+							   tester_davici_iocb, t, &c) >= 0);
+	assert(davici_register(c, "log", logcb, t) >= 0);
+	assert(davici_write(c) >= 0);
+
+	/* accept, then handle registration */
+	tester_runserver(t, -1);
+	tester_runserver(t, -1);
+
+	/* confirmation plus nine events */
+	assert(davici_read_budget(c, 10, 0) == 1);
+	assert(seen == 9);
+	while (seen < event_count / 2)
+	{
+		last = seen;
+		assert(davici_read_budget(c, 10, 0) == 1);
+		assert(seen == last + 10);
+	}
+	/* a time budget exceeded dispatches a single message */
+	while (seen < event_count - 1)
+	{
+		last = seen;
+		assert(davici_read_budget(c, 0, 1) == 1);
+		assert(seen == last + 1);
+	}
+	ret = davici_read_budget(c, 0, 1);
+	assert(ret == 0 || ret == 1);
+	assert(seen == event_count);
+	assert(davici_read_budget(c, 10, 0) == 0);
+	assert(davici_read(c) == 0);
+
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
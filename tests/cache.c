@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static unsigned int seen = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[512];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "load-conn");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	char conn[16];
+
+	snprintf(conn, sizeof(conn), "conn%u", seen);
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, conn) == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "remote_addrs") == 0);
+	assert(davici_value_strcmp(res, "192.0.2.1") == 0);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_END);
+	if (++seen == 2)
+	{
+		tester_complete(t);
+	}
+}
+
+static struct davici_message* build(const char *conn)
+{
+	struct davici_message *msg;
+	struct davici_request *r;
+
+	assert(davici_new_cmd("load-conn", &r) >= 0);
+	davici_section_start(r, conn);
+	davici_kvf(r, "remote_addrs", "192.0.2.1");
+	davici_section_end(r);
+	assert(davici_freeze(r, &msg) >= 0);
+	return msg;
+}
+
+static void patch(const char *path, off_t offset)
+{
+	unsigned char c;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	assert(fd >= 0);
+	assert(pread(fd, &c, 1, offset) == 1);
+	c ^= 0x01;
+	assert(pwrite(fd, &c, 1, offset) == 1);
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_message *msgs[2], *msg;
+	struct davici_cache *cache;
+	struct davici_conn *c;
+	struct tester *t;
+	char path[] = "/tmp/davici-cache-XXXXXX";
+	unsigned int i;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	msgs[0] = build("conn0");
+	msgs[1] = build("conn1");
+	assert(davici_cache_write(path, 42, msgs, 2) == 0);
+	davici_message_unref(msgs[0]);
+	davici_message_unref(msgs[1]);
+
+	assert(davici_cache_open(path, 41, &cache) == -ESTALE);
+	assert(davici_cache_open(path, 42, &cache) == 0);
+	assert(davici_cache_count(cache) == 2);
+	assert(davici_cache_get(cache, 2, &msg) == -ENOENT);
+	for (i = 0; i < 2; i++)
+	{
+		assert(davici_cache_get(cache, i, &msg) == 0);
+		assert(davici_queue_message(c, msg, reqcb, t) >= 0);
+		davici_message_unref(msg);
+	}
+	/* queued messages keep the mapping */
+	davici_cache_close(cache);
+
+	tester_runio(t, c);
+	assert(seen == 2);
+	davici_disconnect(c);
+	tester_cleanup(t);
+
+	/* corrupt a message */
+	patch(path, 40);
+	assert(davici_cache_open(path, 42, &cache) == -EBADMSG);
+	patch(path, 40);
+	assert(davici_cache_open(path, 42, &cache) == 0);
+	davici_cache_close(cache);
+	/* unknown version */
+	patch(path, 7);
+	assert(davici_cache_open(path, 42, &cache) == -EPROTO);
+
+	unlink(path);
+	assert(davici_cache_open(path, 42, &cache) == -ENOENT);
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include "tester.h"
+
+#include <davici_sync.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+static char received[512];
+static unsigned int expected = 0;
+static unsigned int results = 0;
+static unsigned int failures = 0;
+static unsigned int unloads = 0;
+static int fail_bad = 1;
+static struct tester *current;
+
+static void servercb(struct tester *t, int fd)
+{
+	unsigned char buf[512];
+	const char *value;
+	uint32_t len;
+	char res[32];
+	size_t pos;
+	int reslen;
+
+	assert(read(fd, &len, sizeof(len)) == sizeof(len));
+	len = ntohl(len);
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	assert(buf[0] == 0 && buf[1] < len - 2);
+	/* record command names, fail requests for "bad" entries */
+	pos = strlen(received);
+	snprintf(received + pos, sizeof(received) - pos, "%.*s ",
+			 buf[1], buf + 2);
+	value = fail_bad && memmem(buf, len, "bad", 3) ? "no" : "yes";
+	reslen = snprintf(res, sizeof(res), "%c%c%s%c%c%s", DAVICI_KEY_VALUE,
+					  (int)strlen("success"), "success", 0,
+					  (int)strlen(value), value);
+	tester_write_cmdres(fd, res, reslen);
+}
+
+static void synccb(struct davici_conn *conn, enum davici_sync_type type,
+				   const char *name, int unload, int err,
+				   struct davici_response *res, void *user)
+{
+	if (fail_bad && strcmp(name, "bad") == 0)
+	{
+		assert(err == -EIO);
+		assert(res);
+		failures++;
+	}
+	else
+	{
+		assert(err == 0);
+	}
+	if (unload)
+	{
+		unloads++;
+	}
+	if (++results == expected)
+	{
+		tester_complete(current);
+	}
+}
+
+static int load(struct davici_sync *sync, struct davici_conn *c,
+				enum davici_sync_type type, const char *name,
+				const char *value)
+{
+	struct davici_request *r;
+	const char *cmd[] = {
+		[DAVICI_SYNC_CONN] = "load-conn",
+		[DAVICI_SYNC_POOL] = "load-pool",
+		[DAVICI_SYNC_SHARED] = "load-shared",
+	};
+
+	assert(davici_new_cmd(cmd[type], &r) >= 0);
+	davici_section_start(r, name);
+	davici_kvf(r, "value", "%s", value);
+	davici_section_end(r);
+	return davici_sync_load(sync, c, type, name, r);
+}
+
+static void run(struct tester *t, struct davici_conn *c, unsigned int count,
+				const char *cmds)
+{
+	expected = count;
+	results = 0;
+	if (count)
+	{
+		tester_runio(t, c);
+	}
+	assert(results == count);
+	assert(strcmp(received, cmds) == 0);
+	received[0] = 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_sync *sync;
+	struct davici_conn *c;
+	struct tester *t;
+	unsigned int i;
+
+	t = tester_create(servercb);
+	current = t;
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+	assert(davici_sync_create(synccb, NULL, &sync) == 0);
+
+	davici_sync_begin(sync);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "a", "1") == 1);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "b", "1") == 1);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "bad", "1") == 1);
+	assert(load(sync, c, DAVICI_SYNC_POOL, "p", "1") == 1);
+	assert(load(sync, c, DAVICI_SYNC_SHARED, "s", "1") == 1);
+	assert(davici_sync_commit(sync, c) == 0);
+	run(t, c, 5, "load-conn load-conn load-conn load-pool load-shared ");
+
+	/* change "b", retry "bad" and drop "p" */
+	davici_sync_begin(sync);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "a", "1") == 0);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "b", "2") == 1);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "bad", "1") == 1);
+	assert(load(sync, c, DAVICI_SYNC_SHARED, "s", "1") == 0);
+	assert(davici_sync_commit(sync, c) == 1);
+	run(t, c, 3, "load-conn load-conn unload-pool ");
+	assert(failures == 2 && unloads == 1);
+
+	davici_sync_begin(sync);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "a", "1") == 0);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "b", "2") == 0);
+	assert(load(sync, c, DAVICI_SYNC_SHARED, "s", "1") == 0);
+	assert(davici_sync_commit(sync, c) == 1);
+	run(t, c, 1, "unload-conn ");
+	assert(failures == 3 && unloads == 2);
+
+	/* the failed unload of "bad" gets retried until it succeeds */
+	for (i = 0; i < 3; i++)
+	{
+		fail_bad = i == 0;
+		davici_sync_begin(sync);
+		assert(load(sync, c, DAVICI_SYNC_CONN, "a", "1") == 0);
+		assert(load(sync, c, DAVICI_SYNC_CONN, "b", "2") == 0);
+		assert(load(sync, c, DAVICI_SYNC_SHARED, "s", "1") == 0);
+		assert(davici_sync_commit(sync, c) == (i < 2));
+		run(t, c, i < 2, i < 2 ? "unload-conn " : "");
+	}
+	assert(failures == 4 && unloads == 4);
+
+	davici_sync_reset(sync);
+	davici_sync_begin(sync);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "a", "1") == 1);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "b", "2") == 1);
+	assert(load(sync, c, DAVICI_SYNC_SHARED, "s", "1") == 1);
+	assert(davici_sync_commit(sync, c) == 0);
+	run(t, c, 3, "load-conn load-conn load-shared ");
+
+	/* drop in-flight requests, reconnect to a restarted daemon */
+	davici_sync_begin(sync);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "a", "3") == 1);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "b", "2") == 0);
+	assert(davici_sync_commit(sync, c) == 1);
+	davici_disconnect(c);
+	tester_cleanup(t);
+
+	t = tester_create(servercb);
+	current = t;
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+	davici_sync_reset(sync);
+	davici_sync_begin(sync);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "a", "3") == 1);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "b", "2") == 1);
+	assert(davici_sync_commit(sync, c) == 1);
+	run(t, c, 3, "load-conn load-conn unload-shared ");
+
+	davici_sync_begin(sync);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "a", "3") == 0);
+	assert(load(sync, c, DAVICI_SYNC_CONN, "b", "2") == 0);
+	assert(davici_sync_commit(sync, c) == 0);
+
+	davici_sync_destroy(sync);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
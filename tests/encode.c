@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+static char longstr[1024];
+
+static void echocb(struct tester *t, int fd)
+{
+	static char buf[4096];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "encode");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void check_kv(struct davici_response *res, const char *name,
+					 const char *value)
+{
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, name) == 0);
+	assert(davici_value_strcmp(res, value) == 0);
+}
+
+static void check_item(struct davici_response *res, const char *value)
+{
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, value) == 0);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	char buf[2048];
+
+	assert(err >= 0);
+	check_kv(res, "zero", "0");
+	check_kv(res, "max", "18446744073709551615");
+	check_kv(res, "min", "-9223372036854775808");
+	check_kv(res, "neg", "-42");
+	check_kv(res, "yes", "yes");
+	check_kv(res, "no", "no");
+	check_kv(res, "v4", "192.0.2.1");
+	check_kv(res, "v6", "2001:db8::1");
+	check_kv(res, "hex", "00ff1a");
+	check_kv(res, "fmt", "a-1-b");
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_get_value_str(res, buf, sizeof(buf)) == (int)strlen(longstr));
+	assert(strcmp(buf, longstr) == 0);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	check_item(res, "7");
+	check_item(res, "-7");
+	check_item(res, "no");
+	check_item(res, "198.51.100.2");
+	check_item(res, "abcd");
+	check_item(res, "item 3");
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_END);
+	tester_complete(t);
+}
+
+static void build(struct davici_request *r)
+{
+	struct sockaddr_in in = {
+		.sin_family = AF_INET,
+	};
+	struct sockaddr_in6 in6 = {
+		.sin6_family = AF_INET6,
+	};
+
+	assert(inet_pton(AF_INET, "192.0.2.1", &in.sin_addr) == 1);
+	assert(inet_pton(AF_INET6, "2001:db8::1", &in6.sin6_addr) == 1);
+
+	davici_kv_u64(r, "zero", 0);
+	davici_kv_u64(r, "max", UINT64_MAX);
+	davici_kv_i64(r, "min", INT64_MIN);
+	davici_kv_i64(r, "neg", -42);
+	davici_kv_bool(r, "yes", 1);
+	davici_kv_bool(r, "no", 0);
+	davici_kv_inaddr(r, "v4", (struct sockaddr*)&in);
+	davici_kv_inaddr(r, "v6", (struct sockaddr*)&in6);
+	davici_kv_hex(r, "hex", "\x00\xff\x1a", 3);
+	davici_kvf(r, "fmt", "a-%d-%s", 1, "b");
+	davici_kvf(r, "long", "%s", longstr);
+	davici_list_start(r, "list");
+	davici_list_item_u64(r, 7);
+	davici_list_item_i64(r, -7);
+	davici_list_item_bool(r, 0);
+	assert(inet_pton(AF_INET, "198.51.100.2", &in.sin_addr) == 1);
+	davici_list_item_inaddr(r, (struct sockaddr*)&in);
+	davici_list_item_hex(r, "\xab\xcd", 2);
+	davici_list_itemf(r, "item %u", 3);
+	davici_list_end(r);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr sa = {
+		.sa_family = AF_UNIX,
+	};
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+	unsigned int len;
+
+	memset(longstr, 'l', sizeof(longstr) - 1);
+
+	assert(davici_new_measure("encode", &r) >= 0);
+	build(r);
+	len = davici_request_len(r);
+	davici_cancel(r);
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	assert(davici_new_cmd("encode", &r) >= 0);
+	davici_kv_inaddr(r, "unix", &sa);
+	assert(davici_queue(c, r, reqcb, t) == -EAFNOSUPPORT);
+
+	assert(davici_new_cmd("encode", &r) >= 0);
+	build(r);
+	assert(davici_request_len(r) == len);
+	assert(davici_queue(c, r, reqcb, t) >= 0);
+
+	tester_runio(t, c);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static char data[12000];
+
+static void echocb(struct tester *t, int fd)
+{
+	static char buf[65536];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "load-cert");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void check_value(struct davici_response *res, unsigned int offset,
+						unsigned int len)
+{
+	const void *value;
+	unsigned int vlen;
+
+	value = davici_get_value(res, &vlen);
+	assert(vlen == len);
+	assert(memcmp(value, data + offset, len) == 0);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	check_value(res, 0, sizeof(data));
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	check_value(res, 4097, 5000);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	check_value(res, 100, 0);
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_END);
+	tester_complete(t);
+}
+
+int main(int argc, char *argv[])
+{
+	char path[] = "/tmp/davici-file-XXXXXX";
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < sizeof(data); i++)
+	{
+		data[i] = i * 7;
+	}
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+	assert(write(fd, data, sizeof(data)) == sizeof(data));
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	assert(davici_new_cmd("load-cert", &r) >= 0);
+	davici_kv_file(r, "data", -1, 0, 100);
+	assert(davici_queue(c, r, reqcb, t) == -EBADF);
+
+	assert(davici_new_cmd("load-cert", &r) >= 0);
+	davici_kv_file(r, "data", fd, sizeof(data) - 10, 100);
+	assert(davici_queue(c, r, reqcb, t) == -EINVAL);
+	assert(davici_new_cmd("load-cert", &r) >= 0);
+	davici_list_start(r, "chain");
+	davici_list_item_file(r, fd, sizeof(data) + 4096, 1);
+	davici_list_end(r);
+	assert(davici_queue(c, r, reqcb, t) == -EINVAL);
+
+	assert(davici_new_cmd("load-cert", &r) >= 0);
+	davici_kv_file(r, "data", fd, 0, sizeof(data));
+	davici_list_start(r, "chain");
+	davici_list_item_file(r, fd, 4097, 5000);
+	davici_list_item_file(r, fd, 100, 0);
+	davici_list_end(r);
+	close(fd);
+	assert(davici_queue(c, r, reqcb, t) >= 0);
+
+	tester_runio(t, c);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+static const unsigned int event_count = 512;
+static const unsigned int huge_event = 256;
+static unsigned int seen = 0;
+
+static unsigned int put_event(char *buf, unsigned int i)
+{
+	char value[8192];
+	unsigned int len = 0;
+	uint16_t vlen;
+	uint32_t plen;
+
+	if (i == huge_event)
+	{
+		memset(value, 'h', sizeof(value));
+		vlen = sizeof(value);
+	}
+	else
+	{
+		vlen = snprintf(value, sizeof(value), "%u", i);
+	}
+	plen = htonl(1 + 1 + strlen("log") + 1 + 1 + strlen("i") + 2 + vlen);
+	memcpy(buf + len, &plen, sizeof(plen));
+	len += sizeof(plen);
+	buf[len++] = 7;
+	buf[len++] = strlen("log");
+	memcpy(buf + len, "log", strlen("log"));
+	len += strlen("log");
+	buf[len++] = DAVICI_KEY_VALUE;
+	buf[len++] = strlen("i");
+	buf[len++] = 'i';
+	memcpy(buf + len, &(uint16_t){ htons(vlen) }, sizeof(uint16_t));
+	len += sizeof(uint16_t);
+	memcpy(buf + len, value, vlen);
+	return len + vlen;
+}
+
+static void floodcb(struct tester *t, int fd)
+{
+	static char buf[65536];
+	unsigned int i, len = 0;
+
+	tester_read_eventreg(fd, "log");
+	tester_write_eventconfirm(fd);
+	for (i = 0; i < event_count; i++)
+	{
+		len += put_event(buf + len, i);
+		assert(len < sizeof(buf) - 8192 - 64);
+	}
+	/* deliver all events with a single write, split in the middle */
+	assert(write(fd, buf, len / 2 + 3) == len / 2 + 3);
+	assert(write(fd, buf + len / 2 + 3, len - len / 2 - 3) ==
+		   len - len / 2 - 3);
+}
+
+static void logcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	unsigned int i, len;
+
+	assert(err >= 0);
+	assert(strcmp(name, "log") == 0);
+	if (!res)
+	{
+		return;
+	}
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "i") == 0);
+	if (seen == huge_event)
+	{
+		davici_get_value(res, &len);
+		assert(len == 8192);
+	}
+	else
+	{
+		assert(davici_value_escanf(res, "%u", &i) == 0);
+		assert(i == seen);
+	}
+	assert(davici_parse(res) == DAVICI_END);
+	if (++seen == event_count)
+	{
+		tester_complete(t);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct tester *t;
+	struct davici_conn *c;
+
+	t = tester_create(floodcb);
+	assert(davici_connect_unix(tester_getpath(t),
+							   tester_davici_iocb, t, &c) >= 0);
+	assert(davici_register(c, "log", logcb, t) >= 0);
+
+	tester_runio(t, c);
+	assert(seen == event_count);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static int done = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[512];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "load-conn");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	const char *conn = user ? "b" : "a";
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, conn) == 0);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	assert(davici_name_strcmp(res, "proposals") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, "aes128-sha256-x25519") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, "local") == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "auth") == 0);
+	assert(davici_value_strcmp(res, "pubkey") == 0);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_END);
+	if (t)
+	{
+		tester_complete(t);
+	}
+	done++;
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_request *r, *frag, *bad;
+	struct davici_conn *c;
+	struct tester *t;
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	assert(davici_new_fragment(&frag) >= 0);
+	davici_list_start(frag, "proposals");
+	davici_list_item(frag, "aes128-sha256-x25519",
+					 strlen("aes128-sha256-x25519"));
+	davici_list_end(frag);
+	davici_section_start(frag, "local");
+
+	assert(davici_new_fragment(&bad) >= 0);
+	davici_list_item(bad, "x", 1);
+	assert(davici_new_cmd("load-conn", &r) >= 0);
+	assert(davici_add_fragment(r, bad) == -EBADMSG);
+	assert(davici_add_fragment(r, frag) == -EBADMSG);
+	assert(davici_add_fragment(r, r) == -EINVAL);
+	davici_cancel(r);
+	davici_cancel(bad);
+	assert(davici_new_fragment(&bad) >= 0);
+	assert(davici_queue(c, bad, reqcb, NULL) == -EINVAL);
+
+	davici_kv(frag, "auth", "pubkey", strlen("pubkey"));
+	davici_section_end(frag);
+
+	assert(davici_new_cmd("load-conn", &r) >= 0);
+	davici_section_start(r, "a");
+	assert(davici_add_fragment(r, frag) == 0);
+	davici_section_end(r);
+	assert(davici_queue(c, r, reqcb, NULL) >= 0);
+
+	assert(davici_new_cmd("load-conn", &r) >= 0);
+	davici_section_start(r, "b");
+	assert(davici_add_fragment(r, frag) == 0);
+	davici_section_end(r);
+	assert(davici_queue(c, r, reqcb, t) >= 0);
+	davici_cancel(frag);
+
+	tester_runio(t, c);
+	assert(done == 2);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
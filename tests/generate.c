@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+static const unsigned int conn_count = 2000;
+static int state = 0;
+static int client_fd = -1;
+static int client_ops = 0;
+static int done = 0;
+
+static void readall(int fd, void *buf, unsigned int len)
+{
+	ssize_t ret;
+
+	while (len)
+	{
+		ret = read(fd, buf, len);
+		assert(ret > 0);
+		buf = (char*)buf + ret;
+		len -= ret;
+	}
+}
+
+static void servercb(struct tester *t, int fd)
+{
+	unsigned char *buf, *pos;
+	unsigned int i, len, vlen;
+	char name[32];
+
+	len = tester_read_cmdreq(fd, "load-conns");
+	buf = malloc(len);
+	assert(buf);
+	readall(fd, buf, len);
+	pos = buf;
+	for (i = 0; i < conn_count; i++)
+	{
+		snprintf(name, sizeof(name), "conn%u", i);
+		assert(*pos++ == DAVICI_SECTION_START);
+		assert(*pos == strlen(name) && memcmp(pos + 1, name, *pos) == 0);
+		pos += 1 + *pos;
+		assert(*pos++ == DAVICI_KEY_VALUE);
+		assert(*pos == strlen("remote") &&
+			   memcmp(pos + 1, "remote", *pos) == 0);
+		pos += 1 + *pos;
+		vlen = (pos[0] << 8) | pos[1];
+		pos += 2 + vlen;
+		assert(*pos++ == DAVICI_SECTION_END);
+	}
+	assert(pos == buf + len);
+	free(buf);
+	state++;
+	tester_write_cmdres(fd, NULL, 0);
+}
+
+static int iocb(struct davici_conn *c, int fd, int ops, void *user)
+{
+	client_fd = fd;
+	client_ops = ops;
+	return 0;
+}
+
+static int gen(struct davici_request *r, unsigned int index, void *user)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "conn%u", index);
+	davici_section_start(r, name);
+	davici_kvf(r, "remote", "192.0.2.%u", index % 256);
+	davici_section_end(r);
+	return index + 1 < conn_count;
+}
+
+static int badgen(struct davici_request *r, unsigned int index, void *user)
+{
+	return -ENOTSUP;
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_END);
+	done = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_conn *c;
+	struct tester *t;
+	struct pollfd pfd;
+	int status;
+	pid_t pid;
+
+	t = tester_create(servercb);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0)
+	{
+		while (state < 1)
+		{
+			tester_runserver(t, -1);
+		}
+		_exit(0);
+	}
+
+	assert(davici_connect_unix(tester_getpath(t), iocb, t, &c) >= 0);
+	assert(davici_queue_generated(c, "load-conns", badgen,
+								  reqcb, NULL) == -ENOTSUP);
+	assert(davici_queue_generated(c, "load-conns", gen, reqcb, NULL) >= 0);
+
+	while (!done)
+	{
+		pfd.fd = client_fd;
+		pfd.events = 0;
+		if (client_ops & DAVICI_READ)
+		{
+			pfd.events |= POLLIN;
+		}
+		if (client_ops & DAVICI_WRITE)
+		{
+			pfd.events |= POLLOUT;
+		}
+		assert(poll(&pfd, 1, -1) >= 0);
+		if (pfd.revents & POLLIN)
+		{
+			assert(davici_read(c) >= 0);
+		}
+		if (pfd.revents & POLLOUT)
+		{
+			assert(davici_write(c) >= 0);
+		}
+	}
+
+	davici_disconnect(c);
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+static const unsigned int section_count = 256;
+static const unsigned int value_len = 1000;
+static int state = 0;
+static int client_fd = -1;
+static int client_ops = 0;
+static int done = 0;
+
+struct counts {
+	unsigned int sections;
+	unsigned int kvs;
+	unsigned int lists;
+	unsigned int items;
+	unsigned int ends;
+};
+
+static unsigned int put_name(unsigned char *buf, int type, const char *name)
+{
+	buf[0] = type;
+	buf[1] = strlen(name);
+	memcpy(buf + 2, name, strlen(name));
+	return 2 + strlen(name);
+}
+
+static unsigned int put_value(unsigned char *buf, unsigned int len)
+{
+	memcpy(buf, &(uint16_t){ htons(len) }, sizeof(uint16_t));
+	memset(buf + sizeof(uint16_t), 'x', len);
+	return sizeof(uint16_t) + len;
+}
+
+static void bigres(int fd)
+{
+	unsigned char *buf;
+	unsigned int i, len = 0;
+	char name[16];
+
+	tester_read_cmdreq(fd, "bigreq");
+	buf = malloc(section_count * (value_len + 64));
+	assert(buf);
+	for (i = 0; i < section_count; i++)
+	{
+		snprintf(name, sizeof(name), "s%u", i);
+		len += put_name(buf + len, DAVICI_SECTION_START, name);
+		len += put_name(buf + len, DAVICI_KEY_VALUE, "key");
+		len += put_value(buf + len, value_len);
+		len += put_name(buf + len, DAVICI_LIST_START, "list");
+		buf[len++] = DAVICI_LIST_ITEM;
+		len += put_value(buf + len, 1);
+		buf[len++] = DAVICI_LIST_END;
+		buf[len++] = DAVICI_SECTION_END;
+	}
+	tester_write_cmdres(fd, (char*)buf, len);
+	free(buf);
+}
+
+static void servercb(struct tester *t, int fd)
+{
+	char buf[64];
+	uint32_t len;
+
+	switch (state++)
+	{
+		case 0:
+			bigres(fd);
+			break;
+		case 1:
+			len = tester_read_cmdreq(fd, "echoreq");
+			assert(len < sizeof(buf));
+			assert(read(fd, buf, len) == len);
+			tester_write_cmdres(fd, buf, len);
+			break;
+		default:
+			assert(0);
+			break;
+	}
+}
+
+static int iocb(struct davici_conn *c, int fd, int ops, void *user)
+{
+	client_fd = fd;
+	client_ops = ops;
+	return 0;
+}
+
+static int elementcb(struct davici_response *res, enum davici_element type,
+					 void *user)
+{
+	struct counts *counts = user;
+	unsigned int len;
+
+	switch (type)
+	{
+		case DAVICI_SECTION_START:
+			assert(davici_get_level(res) == 1);
+			counts->sections++;
+			break;
+		case DAVICI_KEY_VALUE:
+			assert(davici_name_strcmp(res, "key") == 0);
+			assert(davici_get_value(res, &len) && len == value_len);
+			counts->kvs++;
+			break;
+		case DAVICI_LIST_START:
+			assert(davici_name_strcmp(res, "list") == 0);
+			counts->lists++;
+			break;
+		case DAVICI_LIST_ITEM:
+			assert(davici_value_strcmp(res, "x") == 0);
+			counts->items++;
+			break;
+		case DAVICI_LIST_END:
+		case DAVICI_SECTION_END:
+			counts->ends++;
+			break;
+		default:
+			assert(0);
+			break;
+	}
+	return 0;
+}
+
+static void bigcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct counts *counts = user;
+
+	assert(err == 0);
+	assert(res == NULL);
+	assert(strcmp(name, "bigreq") == 0);
+	assert(counts->sections == section_count);
+	assert(counts->kvs == section_count);
+	assert(counts->lists == section_count);
+	assert(counts->items == section_count);
+	assert(counts->ends == section_count * 2);
+}
+
+static void echocb(struct davici_conn *c, int err, const char *name,
+				   struct davici_response *res, void *user)
+{
+	assert(err == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_value_strcmp(res, "value") == 0);
+	assert(davici_parse(res) == DAVICI_END);
+	done = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct counts counts = { 0 };
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+	struct pollfd pfd;
+	int status;
+	pid_t pid;
+
+	t = tester_create(servercb);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0)
+	{
+		while (state < 2)
+		{
+			tester_runserver(t, -1);
+		}
+		_exit(0);
+	}
+
+	assert(davici_connect_unix(tester_getpath(t), iocb, t, &c) >= 0);
+	/* the limit applies to the echo response, but not to incremental ones */
+	assert(davici_set_limit(c, DAVICI_LIMIT_MSG_SIZE, 4096) == 0);
+
+	assert(davici_new_cmd("bigreq", &r) >= 0);
+	assert(davici_queue_incremental(c, r, elementcb, bigcb, &counts) >= 0);
+	assert(davici_new_cmd("echoreq", &r) >= 0);
+	davici_kv(r, "key", "value", strlen("value"));
+	assert(davici_queue(c, r, echocb, NULL) >= 0);
+
+	while (!done)
+	{
+		pfd.fd = client_fd;
+		pfd.events = 0;
+		if (client_ops & DAVICI_READ)
+		{
+			pfd.events |= POLLIN;
+		}
+		if (client_ops & DAVICI_WRITE)
+		{
+			pfd.events |= POLLOUT;
+		}
+		assert(poll(&pfd, 1, -1) >= 0);
+		if (pfd.revents & POLLIN)
+		{
+			assert(davici_read(c) >= 0);
+		}
+		if (pfd.revents & POLLOUT)
+		{
+			assert(davici_write(c) >= 0);
+		}
+	}
+	assert(counts.sections == section_count);
+
+	davici_disconnect(c);
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+static const unsigned int msg_limit = 256;
+static const unsigned int queue_limit = 128;
+static int client_fd = -1;
+static int client_ops = 0;
+
+static void bigcb(struct tester *t, int fd)
+{
+	char buf[1024];
+	uint16_t vlen;
+
+	tester_read_cmdreq(fd, "bigreq");
+	vlen = sizeof(buf) - 1 - 1 - strlen("key") - 2;
+	buf[0] = DAVICI_KEY_VALUE;
+	buf[1] = strlen("key");
+	memcpy(buf + 2, "key", strlen("key"));
+	memcpy(buf + 2 + strlen("key"), &(uint16_t){ htons(vlen) }, 2);
+	memset(buf + 2 + strlen("key") + 2, 'b', vlen);
+	tester_write_cmdres(fd, buf, sizeof(buf));
+}
+
+static int iocb(struct davici_conn *c, int fd, int ops, void *user)
+{
+	client_fd = fd;
+	client_ops = ops;
+	return 0;
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	assert(err < 0);
+}
+
+static int new_request(unsigned int vlen, struct davici_request **r)
+{
+	char value[64];
+
+	assert(vlen <= sizeof(value));
+	memset(value, 'v', vlen);
+	assert(davici_new_cmd("bigreq", r) >= 0);
+	davici_kv(*r, "key", value, vlen);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tester *t;
+	struct davici_conn *c;
+	struct davici_request *r;
+	struct pollfd pfd;
+	char event[61];
+	int ret = 0;
+
+	t = tester_create(bigcb);
+	assert(davici_connect_unix(tester_getpath(t), iocb, t, &c) >= 0);
+	assert(davici_set_limit(c, DAVICI_LIMIT_MSG_SIZE, msg_limit) == 0);
+	assert(davici_set_limit(c, DAVICI_LIMIT_SEND_QUEUE, queue_limit) == 0);
+	assert(davici_set_limit(c, 42, 0) == -EINVAL);
+
+	new_request(64, &r);
+	assert(davici_queue(c, r, reqcb, t) >= 0);
+	new_request(64, &r);
+	assert(davici_queue(c, r, reqcb, t) == -ENOBUFS);
+	memset(event, 'e', sizeof(event) - 1);
+	event[sizeof(event) - 1] = '\0';
+	assert(davici_register(c, event, reqcb, t) == -ENOBUFS);
+	assert(davici_unregister(c, event, reqcb, t) == -ENOBUFS);
+	assert(davici_queue_len(c) == 1);
+
+	while (ret >= 0)
+	{
+		tester_runserver(t, 0);
+		pfd.fd = client_fd;
+		pfd.events = 0;
+		if (client_ops & DAVICI_READ)
+		{
+			pfd.events |= POLLIN;
+		}
+		if (client_ops & DAVICI_WRITE)
+		{
+			pfd.events |= POLLOUT;
+		}
+		assert(poll(&pfd, 1, 10) >= 0);
+		if (pfd.revents & POLLIN)
+		{
+			ret = davici_read(c);
+		}
+		if (ret >= 0 && (pfd.revents & POLLOUT))
+		{
+			assert(davici_write(c) >= 0);
+		}
+	}
+	assert(ret == -EMSGSIZE);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <davici_loop.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static const unsigned int request_count = 64;
+static unsigned int seen = 0;
+static unsigned int failed = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[512];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "echoreq");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void errcb(struct davici_conn *c, int err, void *user)
+{
+	assert(err == -ECONNRESET);
+	failed++;
+	davici_disconnect(c);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct davici_loop *loop = user;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_value_strcmp(res, "value") == 0);
+	assert(davici_parse(res) == DAVICI_END);
+	if (++seen == request_count)
+	{
+		davici_loop_stop(loop);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_loop *loop;
+	struct tester *t;
+	struct davici_conn *c;
+	struct davici_request *r;
+	unsigned int i;
+
+	assert(davici_loop_create(errcb, NULL, &loop) >= 0);
+	assert(davici_loop_get_fd(loop) >= 0);
+	assert(davici_loop_run(loop) == 0);
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t),
+							   davici_loop_fdcb, loop, &c) >= 0);
+	for (i = 0; i < request_count; i++)
+	{
+		assert(davici_new_cmd("echoreq", &r) >= 0);
+		davici_kv(r, "key", "value", strlen("value"));
+		assert(davici_queue(c, r, reqcb, loop) >= 0);
+	}
+
+	while (seen < request_count)
+	{
+		assert(davici_loop_run_once(loop, 1) >= 0);
+		tester_runserver(t, 0);
+	}
+
+	/* closing the server side fails and unregisters the connection */
+	tester_cleanup(t);
+	assert(davici_loop_run(loop) == 0);
+	assert(failed == 1);
+
+	davici_loop_destroy(loop);
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+static const unsigned int request_count = 96;
+static unsigned char value[4000];
+static unsigned char blob[1000];
+static unsigned int state = 0;
+static int client_fd = -1;
+static int client_ops = 0;
+static unsigned int seen = 0;
+
+static void readall(int fd, void *buf, unsigned int len)
+{
+	ssize_t ret;
+
+	while (len)
+	{
+		ret = read(fd, buf, len);
+		assert(ret > 0);
+		buf = (char*)buf + ret;
+		len -= ret;
+	}
+}
+
+static unsigned int put_kv(unsigned char *buf, const char *name,
+						   const void *data, unsigned int len)
+{
+	buf[0] = DAVICI_KEY_VALUE;
+	buf[1] = strlen(name);
+	memcpy(buf + 2, name, strlen(name));
+	buf += 2 + strlen(name);
+	memcpy(buf, &(uint16_t){ htons(len) }, sizeof(uint16_t));
+	memcpy(buf + sizeof(uint16_t), data, len);
+	return 2 + strlen(name) + sizeof(uint16_t) + len;
+}
+
+static void fill(unsigned char *buf, unsigned int len, unsigned int seed)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+	{
+		buf[i] = (seed * 31 + i) & 0xff;
+	}
+}
+
+static void servercb(struct tester *t, int fd)
+{
+	unsigned char *expected, *buf;
+	unsigned int len, exp = 0;
+
+	len = tester_read_cmdreq(fd, "bulk");
+	fill(value, sizeof(value), state);
+	expected = malloc(sizeof(value) + sizeof(blob) + 64);
+	buf = malloc(len);
+	assert(expected && buf);
+	exp += put_kv(expected + exp, "data", value, sizeof(value));
+	exp += put_kv(expected + exp, "blob", blob, sizeof(blob));
+	assert(len == exp);
+	readall(fd, buf, len);
+	assert(memcmp(buf, expected, len) == 0);
+	free(expected);
+	free(buf);
+	state++;
+	tester_write_cmdres(fd, NULL, 0);
+}
+
+static int iocb(struct davici_conn *c, int fd, int ops, void *user)
+{
+	int size = 4096;
+
+	if (client_fd != fd)
+	{
+		/* force partial writes with a small send buffer */
+		assert(setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+						  &size, sizeof(size)) == 0);
+	}
+	client_fd = fd;
+	client_ops = ops;
+	return 0;
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_END);
+	seen++;
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+	struct pollfd pfd;
+	unsigned int i;
+	int status;
+	pid_t pid;
+
+	fill(blob, sizeof(blob), 0xb10b);
+	t = tester_create(servercb);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0)
+	{
+		while (state < request_count)
+		{
+			tester_runserver(t, -1);
+		}
+		_exit(0);
+	}
+
+	assert(davici_connect_unix(tester_getpath(t), iocb, t, &c) >= 0);
+	for (i = 0; i < request_count; i++)
+	{
+		fill(value, sizeof(value), i);
+		assert(davici_new_cmd("bulk", &r) >= 0);
+		davici_kv(r, "data", value, sizeof(value));
+		davici_kv_ref(r, "blob", blob, sizeof(blob), NULL, NULL);
+		assert(davici_queue(c, r, reqcb, NULL) >= 0);
+	}
+
+	while (seen < request_count)
+	{
+		pfd.fd = client_fd;
+		pfd.events = 0;
+		if (client_ops & DAVICI_READ)
+		{
+			pfd.events |= POLLIN;
+		}
+		if (client_ops & DAVICI_WRITE)
+		{
+			pfd.events |= POLLOUT;
+		}
+		assert(poll(&pfd, 1, -1) >= 0);
+		if (pfd.revents & POLLIN)
+		{
+			assert(davici_read(c) >= 0);
+		}
+		if (pfd.revents & POLLOUT)
+		{
+			assert(davici_write(c) >= 0);
+		}
+	}
+
+	davici_disconnect(c);
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	tester_cleanup(t);
+	return 0;
+}
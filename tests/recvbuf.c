@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+static const unsigned int large_count = 200;
+static const unsigned int small_count = 64;
+static struct tester_allocs counter = { 0 };
+static unsigned int seen = 0;
+static pid_t writer = -1;
+
+static unsigned int value_len(unsigned int i)
+{
+	if (i >= large_count)
+	{
+		return 1000;
+	}
+	return i % 2 ? 20000 : 5000;
+}
+
+static void eventscb(struct tester *t, int fd)
+{
+	static char value[20000 + 32];
+	unsigned int i, len, vlen;
+
+	tester_read_eventreg(fd, "log");
+	tester_write_eventconfirm(fd);
+	/* write from another process, the client can't read while we block */
+	writer = fork();
+	assert(writer >= 0);
+	if (writer)
+	{
+		return;
+	}
+	for (i = 0; i < large_count + small_count; i++)
+	{
+		vlen = value_len(i);
+		len = 0;
+		value[len++] = DAVICI_KEY_VALUE;
+		value[len++] = strlen("v");
+		value[len++] = 'v';
+		memcpy(value + len, &(uint16_t){ htons(vlen) }, sizeof(uint16_t));
+		len += sizeof(uint16_t);
+		memset(value + len, 'v', vlen);
+		tester_write_event(fd, "log", value, len + vlen);
+	}
+	_exit(0);
+}
+
+static void logcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	unsigned int len;
+
+	assert(err >= 0);
+	if (!res)
+	{
+		return;
+	}
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	davici_get_value(res, &len);
+	assert(len == value_len(seen));
+	assert(davici_parse(res) == DAVICI_END);
+	if (++seen == large_count + small_count)
+	{
+		tester_complete(t);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct tester *t;
+	struct davici_conn *c;
+	int status;
+
+	tester_count_allocs(&counter);
+
+	t = tester_create(eventscb);
+	assert(davici_connect_unix(tester_getpath(t),
+							   tester_davici_iocb, t, &c) >= 0);
+	assert(davici_register(c, "log", logcb, t) >= 0);
+
+	counter.resizes = 0;
+	tester_runio(t, c);
+	assert(seen == large_count + small_count);
+	/* grow for 5000 and 20000 byte events, shrink after small ones */
+	assert(counter.resizes <= 3);
+	assert(waitpid(writer, &status, 0) == writer);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	davici_disconnect(c);
+	tester_cleanup(t);
+	tester_count_allocs(NULL);
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static const unsigned int blob_count = 80;
+static char blob[512];
+static unsigned int released = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	static char buf[65536];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "load-cert");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void release(const void *buf, unsigned int len, void *user)
+{
+	assert(buf == blob);
+	assert(len == sizeof(blob) || len > UINT16_MAX);
+	assert(user == &released);
+	released++;
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	const void *value;
+	unsigned int i, len;
+
+	assert(err >= 0);
+	assert(released == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_value_strcmp(res, "x509") == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	value = davici_get_value(res, &len);
+	assert(len == sizeof(blob) && memcmp(value, blob, len) == 0);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	for (i = 0; i < blob_count; i++)
+	{
+		assert(davici_parse(res) == DAVICI_LIST_ITEM);
+		value = davici_get_value(res, &len);
+		assert(len == sizeof(blob) && memcmp(value, blob, len) == 0);
+		assert(davici_parse(res) == DAVICI_LIST_ITEM);
+		assert(davici_value_strcmp(res, "sep") == 0);
+	}
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_END);
+	tester_complete(t);
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(blob); i++)
+	{
+		blob[i] = i;
+	}
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	assert(davici_new_cmd("load-cert", &r) >= 0);
+	davici_kv_ref(r, "data", blob, UINT16_MAX + 1, release, &released);
+	assert(released == 1);
+	assert(davici_queue(c, r, reqcb, t) == -EINVAL);
+	released = 0;
+
+	/* more segments than iovecs passed to a single sendmsg() */
+	assert(davici_new_cmd("load-cert", &r) >= 0);
+	davici_kv(r, "type", "x509", strlen("x509"));
+	davici_kv_ref(r, "data", blob, sizeof(blob), release, &released);
+	davici_list_start(r, "chain");
+	for (i = 0; i < blob_count; i++)
+	{
+		davici_list_item_ref(r, blob, sizeof(blob), release, &released);
+		davici_list_item(r, "sep", strlen("sep"));
+	}
+	davici_list_end(r);
+	assert(davici_request_len(r) > (blob_count + 1) * sizeof(blob));
+	assert(davici_queue(c, r, reqcb, t) >= 0);
+
+	tester_runio(t, c);
+	assert(released == blob_count + 1);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
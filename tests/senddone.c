@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/uio.h>
+
+static int client_fd = -1;
+static int client_ops = 0;
+
+static void servercb(struct tester *t, int fd)
+{
+	assert(0);
+}
+
+static int iocb(struct davici_conn *c, int fd, int ops, void *user)
+{
+	client_fd = fd;
+	client_ops = ops;
+	return 0;
+}
+
+static unsigned int send_iov(struct davici_conn *c, int partial)
+{
+	struct iovec iov[8];
+	unsigned int count;
+	ssize_t len;
+
+	count = davici_send_iov(c, iov, sizeof(iov) / sizeof(iov[0]));
+	assert(count);
+	if (partial)
+	{
+		iov[0].iov_len = 1;
+		count = 1;
+	}
+	len = writev(client_fd, iov, count);
+	assert(len > 0);
+	return len;
+}
+
+static void queue(struct davici_conn *c)
+{
+	struct davici_request *r;
+
+	assert(davici_new_cmd("sendreq", &r) >= 0);
+	davici_kv(r, "key", "value", strlen("value"));
+	assert(davici_queue(c, r, NULL, NULL) >= 0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tester *t;
+	struct davici_conn *c;
+
+	t = tester_create(servercb);
+	assert(davici_connect_unix(tester_getpath(t), iocb, t, &c) >= 0);
+
+	queue(c);
+	assert(client_ops & DAVICI_WRITE);
+	assert(davici_send_done(c, send_iov(c, 0)) == 0);
+	/* no need to watch for writability once everything has been sent */
+	assert(client_ops == DAVICI_READ);
+	assert(davici_queue_unsent(c) == 0);
+
+	queue(c);
+	assert(client_ops & DAVICI_WRITE);
+	assert(davici_send_done(c, send_iov(c, 1)) == 0);
+	assert(client_ops & DAVICI_WRITE);
+	assert(davici_queue_unsent(c) == 1);
+
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
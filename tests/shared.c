@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static const unsigned int queue_count = 4;
+static unsigned int seen = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[512];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "load-conn");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	const char *addrs = "192.0.2.1";
+	const void *value;
+	unsigned int len;
+
+	assert(err >= 0);
+	assert(strcmp(name, "load-conn") == 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, "conn") == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "remote_addrs") == 0);
+	value = davici_get_value(res, &len);
+	assert(len >= strlen(addrs) && memcmp(value, addrs, strlen(addrs)) == 0);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_END);
+	if (++seen == queue_count * 2)
+	{
+		tester_complete(t);
+	}
+}
+
+static struct davici_message* build(const char *value)
+{
+	struct davici_message *msg;
+	struct davici_request *r;
+
+	assert(davici_new_cmd("load-conn", &r) >= 0);
+	davici_section_start(r, "conn");
+	davici_kv(r, "remote_addrs", value, strlen(value));
+	davici_section_end(r);
+	assert(davici_freeze(r, &msg) >= 0);
+	return msg;
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_message *small, *large;
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+	unsigned int i;
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	assert(davici_new_cmd("load-conn", &r) >= 0);
+	davici_kv_slot(r, "slot");
+	assert(davici_freeze(r, &small) == -EINVAL);
+
+	small = build("192.0.2.1");
+	/* a large message takes over the request buffer */
+	large = build("192.0.2.1,192.0.2.2,192.0.2.3,192.0.2.4,192.0.2.5,"
+				  "192.0.2.6,192.0.2.7,192.0.2.8,192.0.2.9,192.0.2.10");
+	assert(davici_message_ref(large) == large);
+	davici_message_unref(large);
+
+	for (i = 0; i < queue_count; i++)
+	{
+		assert(davici_queue_message(c, small, reqcb, t) >= 0);
+		assert(davici_queue_message(c, large, reqcb, t) >= 0);
+	}
+	davici_message_unref(small);
+	davici_message_unref(large);
+
+	tester_runio(t, c);
+	assert(seen == queue_count * 2);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static const unsigned int cert_count = 16;
+static const unsigned int cert_len = 2048;
+static struct tester_allocs counter = { 0 };
+
+static void echocb(struct tester *t, int fd)
+{
+	static char buf[65536];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "load-cert");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	unsigned int i, len;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_value_strcmp(res, "x509") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	for (i = 0; i < cert_count; i++)
+	{
+		assert(davici_parse(res) == DAVICI_LIST_ITEM);
+		assert(davici_get_value(res, &len) && len == cert_len);
+	}
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_END);
+	tester_complete(t);
+}
+
+static void build(struct davici_request *r, const char *cert)
+{
+	unsigned int i;
+
+	davici_kv(r, "type", "x509", strlen("x509"));
+	davici_list_start(r, "data");
+	for (i = 0; i < cert_count; i++)
+	{
+		davici_list_item(r, cert, cert_len);
+	}
+	davici_list_end(r);
+}
+
+static void build_fmt(struct davici_request *r, const char *value)
+{
+	davici_kvf(r, "id", "%s", "short");
+	davici_kvf(r, "value", "%s", value);
+}
+
+static void check_fmt(const char *value)
+{
+	struct davici_request *r;
+	uint64_t fmt, raw;
+	unsigned int len, before;
+
+	assert(davici_new_measure("load-shared", &r) >= 0);
+	build_fmt(r, value);
+	len = davici_request_len(r);
+	davici_cancel(r);
+
+	/* a formatted value at the end must not need space for a null */
+	assert(davici_new_cmd_sized("load-shared", len, &r) >= 0);
+	before = counter.allocs + counter.resizes;
+	build_fmt(r, value);
+	assert(counter.allocs + counter.resizes == before);
+	assert(davici_request_len(r) == len);
+	assert(davici_request_hash(r, &fmt) == 0);
+	davici_cancel(r);
+
+	assert(davici_new_cmd("load-shared", &r) >= 0);
+	davici_kv(r, "id", "short", strlen("short"));
+	davici_kv(r, "value", value, strlen(value));
+	assert(davici_request_hash(r, &raw) == 0);
+	davici_cancel(r);
+	assert(fmt == raw);
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+	unsigned int len, before;
+	char cert[2048];
+
+	tester_count_allocs(&counter);
+	memset(cert, 'c', sizeof(cert));
+
+	assert(davici_new_measure("load-cert", &r) >= 0);
+	build(r, cert);
+	len = davici_request_len(r);
+	assert(len > cert_count * cert_len);
+	before = counter.allocs + counter.resizes;
+	assert(davici_reserve(r, 1000000) == 0);
+	assert(counter.allocs + counter.resizes == before);
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+	assert(davici_queue(c, r, NULL, NULL) == -EINVAL);
+
+	counter.fail = 1;
+	assert(davici_new_cmd_sized("load-cert", len, &r) == -ENOMEM);
+	counter.fail = 0;
+
+	before = counter.allocs + counter.resizes;
+	assert(davici_new_cmd_sized("load-cert", len, &r) >= 0);
+	build(r, cert);
+	assert(counter.allocs + counter.resizes == before + 2);
+	assert(davici_request_len(r) == len);
+	assert(davici_queue(c, r, reqcb, t) >= 0);
+
+	assert(davici_new_cmd("load-cert", &r) >= 0);
+	assert(davici_reserve(r, len) == 0);
+	before = counter.allocs + counter.resizes;
+	build(r, cert);
+	assert(counter.allocs + counter.resizes == before);
+	davici_cancel(r);
+
+	check_fmt("x");
+	memset(cert, 'f', 300);
+	cert[300] = '\0';
+	check_fmt(cert);
+
+	tester_runio(t, c);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	tester_count_allocs(NULL);
+	return 0;
+}
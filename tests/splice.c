@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static int state = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[512];
+	uint32_t len;
+
+	switch (state++)
+	{
+		case 0:
+			len = tester_read_cmdreq(fd, "get-conn");
+			break;
+		case 1:
+			len = tester_read_cmdreq(fd, "load-conn");
+			break;
+		default:
+			assert(0);
+			return;
+	}
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void loadcb(struct davici_conn *c, int err, const char *name,
+				   struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, "copy") == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "version") == 0);
+	assert(davici_value_strcmp(res, "2") == 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, "children") == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "mode") == 0);
+	assert(davici_value_strcmp(res, "tunnel") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	assert(davici_name_strcmp(res, "local_ts") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, "10.0.0.0/8") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	assert(davici_name_strcmp(res, "pools") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, "a") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, "b") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_END);
+	tester_complete(t);
+}
+
+static void getcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct davici_request *r;
+
+	assert(err >= 0);
+	assert(davici_new_cmd("load-conn", &r) >= 0);
+	assert(davici_splice(r, res, NULL) == -EINVAL);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_splice(r, res, NULL) == -EINVAL);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, "conn") == 0);
+	assert(davici_splice(r, res, "copy") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	assert(davici_splice(r, res, NULL) == 0);
+	assert(davici_parse(res) == DAVICI_END);
+	assert(davici_queue(c, r, loadcb, user) >= 0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	assert(davici_new_cmd("get-conn", &r) >= 0);
+	davici_kv_u64(r, "skipped", 1);
+	davici_section_start(r, "conn");
+	davici_kv_u64(r, "version", 2);
+	davici_section_start(r, "children");
+	davici_kvf(r, "mode", "tunnel");
+	davici_list_start(r, "local_ts");
+	davici_list_item(r, "10.0.0.0/8", strlen("10.0.0.0/8"));
+	davici_list_end(r);
+	davici_section_end(r);
+	davici_section_end(r);
+	davici_list_start(r, "pools");
+	davici_list_item(r, "a", 1);
+	davici_list_item(r, "b", 1);
+	davici_list_end(r);
+	assert(davici_queue(c, r, getcb, t) >= 0);
+
+	tester_runio(t, c);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
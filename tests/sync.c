@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+static unsigned int fdcbs = 0;
+static int state = 0;
+
+static void echo(int fd, const char *name)
+{
+	char buf[512];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, name);
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void servercb(struct tester *t, int fd)
+{
+	switch (state++)
+	{
+		case 0:
+			echo(fd, "echoreq");
+			break;
+		case 1:
+			tester_read_cmdreq(fd, "unknown");
+			tester_write_cmdunknown(fd);
+			break;
+		case 2:
+			usleep(100000);
+			echo(fd, "slow");
+			break;
+		case 3:
+			echo(fd, "echoreq");
+			break;
+		default:
+			assert(0);
+			break;
+	}
+}
+
+static int countcb(struct davici_conn *c, int fd, int ops, void *user)
+{
+	fdcbs++;
+	return 0;
+}
+
+static void check_response(struct davici_response *res)
+{
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "key") == 0);
+	assert(davici_value_strcmp(res, "value") == 0);
+	assert(davici_parse(res) == DAVICI_END);
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_response *res;
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+	int status;
+	pid_t pid;
+
+	t = tester_create(servercb);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0)
+	{
+		while (state < 4)
+		{
+			tester_runserver(t, -1);
+		}
+		_exit(0);
+	}
+
+	assert(davici_connect_unix(tester_getpath(t), countcb, t, &c) >= 0);
+
+	assert(davici_new_cmd("echoreq", &r) >= 0);
+	davici_kv(r, "key", "value", strlen("value"));
+	assert(davici_call_sync(c, r, 5000, &res) == 0);
+	check_response(res);
+	davici_free_response(res);
+	assert(fdcbs == 1);
+
+	assert(davici_new_cmd("unknown", &r) >= 0);
+	assert(davici_call_sync(c, r, 5000, &res) == -ENOSYS);
+
+	assert(davici_new_cmd("slow", &r) >= 0);
+	davici_kv(r, "key", "value", strlen("value"));
+	assert(davici_call_sync(c, r, 10, &res) == -ETIMEDOUT);
+	assert(davici_queue_len(c) == 1);
+
+	assert(davici_new_cmd("echoreq", &r) >= 0);
+	davici_kv(r, "key", "value", strlen("value"));
+	assert(davici_call_sync(c, r, -1, &res) == 0);
+	check_response(res);
+	davici_free_response(res);
+	assert(davici_queue_len(c) == 0);
+	assert(fdcbs == 1);
+
+	davici_disconnect(c);
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	tester_cleanup(t);
+	return 0;
+}
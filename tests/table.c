@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+#define STR(s) s, sizeof(s) - 1
+
+static const struct davici_desc children[] = {
+	{ DAVICI_SECTION_START, STR("children") },
+	{ DAVICI_SECTION_START, STR("child") },
+	{ DAVICI_KEY_VALUE, STR("mode"), STR("tunnel") },
+	{ DAVICI_LIST_START, STR("local_ts") },
+	{ DAVICI_LIST_ITEM, NULL, 0, STR("10.0.0.0/8") },
+	{ DAVICI_LIST_ITEM, NULL, 0, STR("10.1.0.0/16") },
+	{ DAVICI_LIST_END },
+	{ DAVICI_SECTION_END },
+	{ DAVICI_SECTION_END },
+};
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[512];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "load-conn");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, "conn") == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "version") == 0);
+	assert(davici_value_strcmp(res, "2") == 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, "children") == 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_name_strcmp(res, "child") == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "mode") == 0);
+	assert(davici_value_strcmp(res, "tunnel") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	assert(davici_name_strcmp(res, "local_ts") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, "10.0.0.0/8") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, "10.1.0.0/16") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_END);
+	tester_complete(t);
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_desc bad = {
+		DAVICI_KEY_VALUE, STR("key"), NULL, 65536,
+	};
+	struct davici_request *r;
+	struct davici_conn *c;
+	struct tester *t;
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	assert(davici_new_cmd("load-conn", &r) >= 0);
+	assert(davici_add_table(r, &bad, 1) == -EINVAL);
+	davici_section_start(r, "conn");
+	davici_kv_u64(r, "version", 2);
+	assert(davici_add_table(r, children,
+							sizeof(children) / sizeof(children[0])) == 0);
+	davici_section_end(r);
+	assert(davici_queue(c, r, reqcb, t) >= 0);
+
+	tester_runio(t, c);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+static const char *children[] = {
+	"first",
+	"a-much-longer-child-name-not-fitting-inline-buffers-of-requests",
+	"",
+};
+static unsigned int seen = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[512];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "initiate");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+	const char *child = children[seen];
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "child") == 0);
+	assert(davici_value_strcmp(res, child) == 0);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_name_strcmp(res, "timeout") == 0);
+	assert(davici_value_strcmp(res, "1000") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_START);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, "fixed") == 0);
+	assert(davici_parse(res) == DAVICI_LIST_ITEM);
+	assert(davici_value_strcmp(res, child) == 0);
+	assert(davici_parse(res) == DAVICI_LIST_END);
+	assert(davici_parse(res) == DAVICI_END);
+	if (++seen == sizeof(children) / sizeof(children[0]))
+	{
+		tester_complete(t);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct davici_request *tmpl, *measure, *r;
+	struct davici_slot values[2];
+	struct davici_conn *c;
+	struct tester *t;
+	unsigned int i;
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t), tester_davici_iocb,
+							   t, &c) >= 0);
+
+	assert(davici_new_cmd("initiate", &tmpl) >= 0);
+	davici_kv_slot(tmpl, "child");
+	davici_kvf(tmpl, "timeout", "%d", 1000);
+	davici_list_start(tmpl, "list");
+	davici_list_item(tmpl, "fixed", strlen("fixed"));
+	davici_list_item_slot(tmpl);
+	davici_list_end(tmpl);
+
+	assert(davici_instantiate(tmpl, values, 1, &r) == -EINVAL);
+
+	/* measuring templates have no encoding to instantiate */
+	assert(davici_new_measure("initiate", &measure) >= 0);
+	davici_kv_slot(measure, "child");
+	davici_kvf(measure, "timeout", "%0200d", 1000);
+	assert(davici_instantiate(measure, values, 1, &r) == -EINVAL);
+	davici_cancel(measure);
+
+	for (i = 0; i < sizeof(children) / sizeof(children[0]); i++)
+	{
+		values[0].buf = children[i];
+		values[0].len = strlen(children[i]);
+		values[1] = values[0];
+		assert(davici_instantiate(tmpl, values, 2, &r) >= 0);
+		assert(davici_queue(c, r, reqcb, t) >= 0);
+	}
+
+	davici_cancel(tmpl);
+
+	tester_runio(t, c);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}
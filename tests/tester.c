@@ -154,6 +154,24 @@ void tester_runio(struct tester *t, struct davici_conn *c)
 			t->srvcb(t, t->pfd[FD_SERVER].fd);
 		}
 	}
+	t->complete = 0;
+}
+
+void tester_runserver(struct tester *t, int timeout)
+{
+	int fd;
+
+	assert(poll(&t->pfd[FD_LISTEN], FD_COUNT - FD_LISTEN, timeout) >= 0);
+	if (t->pfd[FD_LISTEN].revents & POLLIN)
+	{
+		fd = accept(t->pfd[FD_LISTEN].fd, NULL, NULL);
+		assert(fd >= 0);
+		t->pfd[FD_SERVER].fd = fd;
+	}
+	if (t->pfd[FD_SERVER].revents & POLLIN)
+	{
+		t->srvcb(t, t->pfd[FD_SERVER].fd);
+	}
 }
 
 void tester_complete(struct tester *t)
@@ -269,3 +287,79 @@ void tester_write_event(int fd, const char *name,
 	assert(write(fd, name, namelen) == namelen);
 	assert(write(fd, buf, buflen) == buflen);
 }
+
+void tester_write_events(int fd, const char *name, unsigned int count)
+{
+	uint8_t namelen, type = EVENT;
+	unsigned int i, pos = 0;
+	uint32_t len;
+	char *buf;
+
+	namelen = strlen(name);
+	len = htonl(sizeof(type) + sizeof(namelen) + namelen);
+	buf = malloc(count * (sizeof(len) + ntohl(len)));
+	assert(buf);
+	for (i = 0; i < count; i++)
+	{
+		memcpy(buf + pos, &len, sizeof(len));
+		pos += sizeof(len);
+		buf[pos++] = type;
+		buf[pos++] = namelen;
+		memcpy(buf + pos, name, namelen);
+		pos += namelen;
+	}
+	assert(write(fd, buf, pos) == pos);
+	free(buf);
+}
+
+static void* count_alloc(size_t size, void *user)
+{
+	struct tester_allocs *allocs = user;
+
+	if (allocs->fail)
+	{
+		return NULL;
+	}
+	allocs->allocs++;
+	return malloc(size);
+}
+
+static void* count_resize(void *ptr, size_t size, void *user)
+{
+	struct tester_allocs *allocs = user;
+
+	if (allocs->fail)
+	{
+		return NULL;
+	}
+	if (ptr)
+	{
+		allocs->resizes++;
+	}
+	else
+	{
+		allocs->allocs++;
+	}
+	return realloc(ptr, size);
+}
+
+static void count_release(void *ptr, void *user)
+{
+	struct tester_allocs *allocs = user;
+
+	assert(ptr);
+	allocs->releases++;
+	free(ptr);
+}
+
+void tester_count_allocs(struct tester_allocs *allocs)
+{
+	struct davici_allocator allocator = {
+		.alloc = count_alloc,
+		.resize = count_resize,
+		.release = count_release,
+		.user = allocs,
+	};
+
+	davici_set_allocator(allocs ? &allocator : NULL);
+}
@@ -18,6 +18,16 @@ struct tester;
 
 typedef void (*tester_srvcb)(struct tester *tester, int fd);
 
+struct tester_allocs {
+	/* new allocations, including resizes of NULL */
+	unsigned int allocs;
+	/* reallocations of existing buffers */
+	unsigned int resizes;
+	unsigned int releases;
+	/* let all allocations fail if set */
+	int fail;
+};
+
 struct tester* tester_create(tester_srvcb srvcb);
 
 struct tester* tester_create_tcp(tester_srvcb srvcb);
@@ -26,6 +36,8 @@ int tester_davici_iocb(struct davici_conn *c, int fd, int ops, void *user);
 
 void tester_runio(struct tester *tester, struct davici_conn *c);
 
+void tester_runserver(struct tester *tester, int timeout);
+
 void tester_complete(struct tester *tester);
 
 const char *tester_getpath(struct tester *tester);
@@ -50,3 +62,7 @@ void tester_write_eventunknown(int fd);
 
 void tester_write_event(int fd, const char *name,
 						const char *buf, unsigned int buflen);
+
+void tester_write_events(int fd, const char *name, unsigned int count);
+
+void tester_count_allocs(struct tester_allocs *allocs);
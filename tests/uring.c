@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <davici_uring.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+static const unsigned int request_count = 64;
+static unsigned int seen = 0;
+static unsigned int events = 0;
+
+#define PEER_COUNT 100
+static const unsigned int ping_rounds = 100;
+static unsigned int pings = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	static unsigned int state = 0;
+	char buf[512];
+	uint32_t len;
+
+	if (state++ == 0)
+	{
+		tester_read_eventreg(fd, "anevent");
+		tester_write_eventconfirm(fd);
+		return;
+	}
+	len = tester_read_cmdreq(fd, "echoreq");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_event(fd, "anevent", NULL, 0);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void errcb(struct davici_conn *c, int err, void *user)
+{
+	assert(0);
+}
+
+static void eventcb(struct davici_conn *c, int err, const char *name,
+					struct davici_response *res, void *user)
+{
+	assert(err >= 0);
+	if (res)
+	{
+		assert(davici_parse(res) == DAVICI_END);
+		events++;
+	}
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_parse(res) == DAVICI_KEY_VALUE);
+	assert(davici_value_strcmp(res, "value") == 0);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_END);
+	seen++;
+}
+
+static void pingcb(struct davici_conn *c, int err, const char *name,
+				   struct davici_response *res, void *user);
+
+static void queue_ping(struct davici_conn *c, unsigned int *rounds)
+{
+	struct davici_request *r;
+
+	assert(davici_new_cmd("ping", &r) >= 0);
+	assert(davici_queue(c, r, pingcb, rounds) >= 0);
+}
+
+static void pingcb(struct davici_conn *c, int err, const char *name,
+				   struct davici_response *res, void *user)
+{
+	unsigned int *rounds = user;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_SECTION_START);
+	assert(davici_parse(res) == DAVICI_SECTION_END);
+	assert(davici_parse(res) == DAVICI_END);
+	pings++;
+	if (++*rounds < ping_rounds)
+	{
+		queue_ping(c, rounds);
+	}
+}
+
+static void run_peer(int *fds)
+{
+	const char res[] = {
+		DAVICI_SECTION_START, 4, 'p', 'o', 'n', 'g', DAVICI_SECTION_END,
+	};
+	struct pollfd pfd[PEER_COUNT];
+	unsigned int i, open = PEER_COUNT;
+	char c;
+
+	for (i = 0; i < PEER_COUNT; i++)
+	{
+		pfd[i].fd = fds[i];
+		pfd[i].events = POLLIN;
+	}
+	while (open)
+	{
+		assert(poll(pfd, PEER_COUNT, -1) > 0);
+		for (i = 0; i < PEER_COUNT; i++)
+		{
+			if (!pfd[i].revents)
+			{
+				continue;
+			}
+			if (recv(pfd[i].fd, &c, sizeof(c), MSG_PEEK) == 0)
+			{
+				close(pfd[i].fd);
+				pfd[i].fd = -1;
+				open--;
+				continue;
+			}
+			assert(tester_read_cmdreq(pfd[i].fd, "ping") == 0);
+			tester_write_cmdres(pfd[i].fd, res, sizeof(res));
+		}
+	}
+}
+
+/* answer from another process, so responses may complete along with the
+ * send of their request */
+static void test_peer(void)
+{
+	struct davici_conn *conns[PEER_COUNT];
+	unsigned int rounds[PEER_COUNT] = { 0 };
+	int fds[PEER_COUNT], own[PEER_COUNT], sv[2], status;
+	struct davici_uring *ring;
+	unsigned int i;
+	pid_t pid;
+
+	assert(davici_uring_create(256, errcb, NULL, &ring) >= 0);
+	for (i = 0; i < PEER_COUNT; i++)
+	{
+		assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+		assert(davici_connect_socket(sv[0], davici_uring_fdcb, ring,
+									 &conns[i]) >= 0);
+		own[i] = sv[0];
+		fds[i] = sv[1];
+	}
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0)
+	{
+		for (i = 0; i < PEER_COUNT; i++)
+		{
+			close(own[i]);
+		}
+		run_peer(fds);
+		_exit(0);
+	}
+	for (i = 0; i < PEER_COUNT; i++)
+	{
+		close(fds[i]);
+		queue_ping(conns[i], &rounds[i]);
+	}
+	while (pings < PEER_COUNT * ping_rounds)
+	{
+		assert(davici_uring_run(ring, 1000) >= 0);
+	}
+	for (i = 0; i < PEER_COUNT; i++)
+	{
+		davici_disconnect(conns[i]);
+	}
+	davici_uring_destroy(ring);
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	struct davici_uring *ring;
+	struct tester *t;
+	struct davici_conn *c;
+	struct davici_request *r;
+	unsigned int i;
+	int err;
+
+	err = davici_uring_create(32, errcb, NULL, &ring);
+	if (err == -ENOSYS || err == -EPERM || err == -ENOTSUP)
+	{
+		/* io_uring not supported or disabled */
+		return 77;
+	}
+	assert(err >= 0);
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t),
+							   davici_uring_fdcb, ring, &c) >= 0);
+	assert(davici_register(c, "anevent", eventcb, NULL) >= 0);
+	for (i = 0; i < request_count; i++)
+	{
+		assert(davici_new_cmd("echoreq", &r) >= 0);
+		davici_section_start(r, "section");
+		davici_kv(r, "key", "value", strlen("value"));
+		davici_section_end(r);
+		assert(davici_queue(c, r, reqcb, NULL) >= 0);
+	}
+
+	while (seen < request_count)
+	{
+		assert(davici_uring_run(ring, 1) >= 0);
+		tester_runserver(t, 0);
+	}
+	assert(events == request_count);
+	assert(davici_queue_len(c) == 0);
+
+	davici_disconnect(c);
+	tester_cleanup(t);
+
+	t = tester_create_tcp(echocb);
+	addr.sin_port = htons(tester_get_tcpport(t));
+	assert(davici_connect_tcp((struct sockaddr*)&addr,
+							  davici_uring_fdcb, ring, &c) >= 0);
+	assert(davici_new_cmd("echoreq", &r) >= 0);
+	davici_section_start(r, "section");
+	davici_kv(r, "key", "value", strlen("value"));
+	davici_section_end(r);
+	assert(davici_queue(c, r, reqcb, NULL) >= 0);
+	while (seen < request_count + 1)
+	{
+		assert(davici_uring_run(ring, 1) >= 0);
+		tester_runserver(t, 0);
+	}
+
+	davici_disconnect(c);
+	davici_uring_destroy(ring);
+	tester_cleanup(t);
+
+	test_peer();
+	return 0;
+}
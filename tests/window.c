@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 onway ag
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tester.h"
+
+#include <assert.h>
+#include <unistd.h>
+#include <stdint.h>
+
+static const unsigned int request_count = 128;
+static const unsigned int window = 4;
+static unsigned int seen = 0;
+
+static void echocb(struct tester *t, int fd)
+{
+	char buf[256];
+	uint32_t len;
+
+	len = tester_read_cmdreq(fd, "echoreq");
+	assert(len < sizeof(buf));
+	assert(read(fd, buf, len) == len);
+	tester_write_cmdres(fd, buf, len);
+}
+
+static void reqcb(struct davici_conn *c, int err, const char *name,
+				  struct davici_response *res, void *user)
+{
+	struct tester *t = user;
+
+	assert(err >= 0);
+	assert(davici_parse(res) == DAVICI_END);
+	assert(davici_queue_inflight(c) < window);
+	assert(davici_queue_len(c) == request_count - seen - 1);
+	assert(davici_queue_unsent(c) + davici_queue_inflight(c) ==
+		   davici_queue_len(c));
+	if (++seen == request_count)
+	{
+		tester_complete(t);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct tester *t;
+	struct davici_conn *c;
+	struct davici_request *r;
+	unsigned int i;
+
+	t = tester_create(echocb);
+	assert(davici_connect_unix(tester_getpath(t),
+							   tester_davici_iocb, t, &c) >= 0);
+	assert(davici_set_window(c, window) >= 0);
+
+	for (i = 0; i < request_count; i++)
+	{
+		assert(davici_new_cmd("echoreq", &r) >= 0);
+		assert(davici_queue(c, r, reqcb, t) >= 0);
+	}
+	assert(davici_queue_len(c) == request_count);
+	assert(davici_queue_unsent(c) == request_count);
+	assert(davici_queue_inflight(c) == 0);
+
+	assert(davici_write(c) >= 0);
+	assert(davici_queue_inflight(c) == window);
+	assert(davici_queue_unsent(c) == request_count - window);
+
+	tester_runio(t, c);
+	assert(seen == request_count);
+	assert(davici_queue_len(c) == 0);
+	assert(davici_queue_unsent(c) == 0);
+	davici_disconnect(c);
+	tester_cleanup(t);
+	return 0;
+}